@@ -0,0 +1,102 @@
+// Check the analysis of a frame by the interpretor doesn't allocate once the histogram keeps its length
+// (with each smoothing, with and without the sliding statistics of the adaptive threshold)
+// Every allocation of the program is counted (glibc : malloc and co are replaced and call the libc ones)
+// Usage : alloc-check [number of frames (default 1000)]
+
+#include <iostream>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <atomic>
+
+#include "../src/extractor.h"
+#include "../src/interpretor.h"
+
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t nb, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void __libc_free(void* ptr);
+}
+
+static std::atomic<int64_t> nb_allocs = 0;
+
+extern "C" void* malloc(size_t size) { nb_allocs++; return __libc_malloc(size); }
+extern "C" void* calloc(size_t nb, size_t size) { nb_allocs++; return __libc_calloc(nb, size); }
+extern "C" void* realloc(void* ptr, size_t size) { nb_allocs++; return __libc_realloc(ptr, size); }
+extern "C" void free(void* ptr) { __libc_free(ptr); }
+
+
+static const size_t BIN_COUNTS[] = {96, 1024, 96};
+
+
+// Each smoothing with and without the sliding statistics of the adaptive threshold
+struct CheckConfig {
+    const char* name;
+    InterpretorSmoothing smoothing;
+    double threshold_window; // In frames (the frames are 1 s apart), 0 for the fixed threshold
+};
+
+static const CheckConfig CONFIGS[] = {
+    {"median smoothing", SMOOTHING_MEDIAN, 0.},
+    {"median smoothing, threshold window", SMOOTHING_MEDIAN, 5.},
+    {"exponential smoothing", SMOOTHING_EXPONENTIAL, 0.},
+    {"exponential smoothing, threshold window", SMOOTHING_EXPONENTIAL, 5.},
+};
+
+constexpr size_t NB_NOTES = 4;
+constexpr int WARMUP_FRAMES = 2;
+
+
+int main(int argc, char** args) {
+    const int nb_frames = argc > 1 ? atoi(args[1]) : 1000;
+
+    Extractor extractor;
+    Interpretor interpretor;
+    Note notes[NB_NOTES];
+    bool ok = true;
+
+    for (const CheckConfig& config : CONFIGS) {
+        interpretor.set_smoothing(config.smoothing, 5., 1.);
+        interpretor.set_threshold_window(config.threshold_window, 1.);
+
+        // The length of the histogram changes like when the frequency domain changes
+        for (const size_t nb_entries : BIN_COUNTS) {
+            extractor.histogram.resize(nb_entries);
+            HistogramEntry* entries = extractor.histogram.entries;
+            for (size_t i = 0; i < nb_entries; i++) entries[i].freq = 20.f * powf(1.0594631f, i % 96);
+            interpretor.set_extractor(&extractor);
+
+            int64_t allocs_before = 0;
+            size_t interpretor_allocs_before = 0;
+            size_t total = 0;
+
+            for (int f = 0; f < WARMUP_FRAMES + nb_frames; f++) {
+                if (f == WARMUP_FRAMES) {
+                    allocs_before = nb_allocs;
+                    interpretor_allocs_before = interpretor.get_nb_allocations();
+                }
+
+                for (size_t i = 0; i < nb_entries; i++) entries[i].value = (float) rand() / RAND_MAX;
+                interpretor.smooth();
+                interpretor.adjust_to_human_hear();
+                interpretor.keep_harmony();
+                interpretor.keep_peeks();
+                interpretor.adjust_to_speaker_physics();
+                total += interpretor.extract_notes(notes, NB_NOTES);
+            }
+
+            const int64_t allocs = nb_allocs - allocs_before;
+            const size_t interpretor_allocs = interpretor.get_nb_allocations() - interpretor_allocs_before;
+            const bool bin_ok = allocs == 0 && interpretor_allocs == 0;
+            ok &= bin_ok;
+
+            std::cout << config.name << ", " << nb_entries << " bins : " << allocs << " allocations (" << interpretor_allocs
+                      << " by the interpretor) in " << nb_frames << " frames, " << total << " notes " << (bin_ok ? "OK" : "FAILED") << std::endl;
+        }
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
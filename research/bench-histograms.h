@@ -0,0 +1,76 @@
+#pragma once
+
+// Histograms and timing loop shared by the benchmarks of the interpretor stages
+// The entries cover the default domain of the extractor (20 Hz to 5 kHz) with increasing frequencies, whatever their number
+
+
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../src/extractor.h"
+
+
+constexpr int BENCH_NB_HISTOGRAMS = 64; // Different histograms analyzed in turn
+constexpr size_t BENCH_MIN_ENTRIES_ANALYZED = 1 << 24; // Frames are analyzed until this many entries were read
+constexpr float BENCH_MIN_FREQ = 20.f;
+constexpr float BENCH_MAX_FREQ = 5000.f;
+
+
+// Frequency of an entry : constant ratio between neighbours from BENCH_MIN_FREQ, all different
+inline float bench_freq(size_t index, size_t nb_entries) {
+    return BENCH_MIN_FREQ * powf(BENCH_MAX_FREQ / BENCH_MIN_FREQ, (float) index / nb_entries);
+}
+
+
+// Noise up to .1 x level with a few peaks up to level
+inline void bench_gen_peaks(HistogramEntry* entries, size_t nb_entries, int nb_peaks, float level = 1.f) {
+    for (size_t i = 0; i < nb_entries; i++) entries[i].value = (float) rand() / RAND_MAX * .1f * level;
+    for (int p = 0; p < nb_peaks; p++) entries[rand() % nb_entries].value += (float) rand() / RAND_MAX * level;
+}
+
+
+// BENCH_NB_HISTOGRAMS histograms of nb_entries one after the other with the frequencies of bench_freq()
+// gen(entries, nb_entries, h) writes the strengths of the h-th one
+template<typename G>
+inline std::vector<HistogramEntry> bench_gen_histograms(size_t nb_entries, G gen) {
+    std::vector<HistogramEntry> histograms(nb_entries * BENCH_NB_HISTOGRAMS);
+    for (int h = 0; h < BENCH_NB_HISTOGRAMS; h++) {
+        HistogramEntry* entries = &histograms[nb_entries * h];
+        for (size_t i = 0; i < nb_entries; i++) entries[i].freq = bench_freq(i, nb_entries);
+        gen(entries, nb_entries, h);
+    }
+    return histograms;
+}
+
+
+// Number of frames analyzed for histograms of nb_entries (every histogram at least once)
+inline int bench_nb_frames(size_t nb_entries, size_t min_frames = BENCH_NB_HISTOGRAMS) {
+    return (int) std::max<size_t>(BENCH_MIN_ENTRIES_ANALYZED / nb_entries, min_frames);
+}
+
+
+// Mean time in ns of analyze() over nb_frames frames, the histograms are copied in turn to entries before each call
+// The same loop with the copies only is timed too and its time is subtracted (the copies cost as much as the fastest stages)
+template<typename F>
+inline double bench_ns_per_frame(HistogramEntry* entries, const std::vector<HistogramEntry>& histograms, size_t nb_entries,
+                                 int nb_frames, F analyze) {
+    const size_t size = nb_entries * sizeof(HistogramEntry);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int f = 0; f < nb_frames; f++) memcpy(entries, &histograms[nb_entries * (f % BENCH_NB_HISTOGRAMS)], size);
+    const double copies = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (int f = 0; f < nb_frames; f++) {
+        memcpy(entries, &histograms[nb_entries * (f % BENCH_NB_HISTOGRAMS)], size);
+        analyze();
+    }
+    const double total = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    return std::max(total - copies, 0.) / nb_frames;
+}
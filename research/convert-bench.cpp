@@ -0,0 +1,88 @@
+// Throughput of the PCM conversions for each format, channel count and instruction set
+// Usage : convert-bench [seconds of audio at 48 kHz (default 60)]
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/convert.h"
+
+
+static const char* FORMAT_NAMES[] = {"u8", "s16", "s24", "s32", "f32", "f64"};
+static const PcmFormat FORMATS[] = {PCM_U8, PCM_S16, PCM_S24, PCM_S32, PCM_F32, PCM_F64};
+static const int32_t CHANNELS[] = {1, 2, 4, 6, 8};
+static const char* KERNELS[] = {"scalar", "sse2", "avx2"};
+
+constexpr int REPEAT = 5;
+
+
+// Best time of REPEAT conversions of the whole buffer in seconds
+static double bench(void** out, const uint8_t* raw, int64_t frames, int32_t nb_channels, PcmFormat format) {
+    double best = 1e30;
+    for (int k = 0; k < REPEAT; k++) {
+        const auto start = std::chrono::steady_clock::now();
+        pcm_deinterleave(out, 0, raw, frames, nb_channels, format);
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (elapsed.count() < best) best = elapsed.count();
+    }
+    return best;
+}
+
+
+int main(int argc, char** args) {
+    const double seconds = argc > 1 ? atof(args[1]) : 60.;
+    const int64_t frames = (int64_t) (seconds * 48000.);
+
+    std::cout << "Default kernels : " << pcm_kernels_name() << std::endl;
+    std::cout << std::left << std::setw(8) << "format" << std::setw(10) << "channels"
+              << std::setw(10) << "kernels" << std::setw(12) << "in GB/s" << "ns/sample" << std::endl;
+
+    for (int f = 0; f < 6; f++) {
+        const PcmFormat format = FORMATS[f];
+        const size_t in_size = pcm_sample_size(format);
+        const size_t out_size = pcm_storage_format(format) == SAMPLE_FMT_INT16 ? sizeof(int16_t) : sizeof(float);
+
+        for (const int32_t nb_channels : CHANNELS) {
+            const size_t raw_size = frames * nb_channels * in_size;
+            std::vector<uint8_t> raw(raw_size);
+            for (size_t i = 0; i < raw_size; i++) raw[i] = (uint8_t) rand();
+
+            // Random doubles can be NaN or huge, use valid samples
+            if (format == PCM_F32 || format == PCM_F64) {
+                for (size_t i = 0; i < raw_size / in_size; i++) {
+                    const double v = (double) rand() / RAND_MAX * 2. - 1.;
+                    const float vf = (float) v;
+                    if (format == PCM_F64) memcpy(&raw[i * in_size], &v, in_size);
+                    else memcpy(&raw[i * in_size], &vf, in_size);
+                }
+            }
+
+            std::vector<uint8_t> planar(frames * nb_channels * out_size);
+            std::vector<void*> out(nb_channels);
+            for (int32_t j = 0; j < nb_channels; j++) out[j] = &planar[frames * j * out_size];
+
+            std::vector<uint8_t> reference;
+            for (const char* name : KERNELS) {
+                if (!pcm_select_kernels(name)) continue;
+
+                const double t = bench(out.data(), raw.data(), frames, nb_channels, format);
+                const int64_t samples = frames * nb_channels;
+
+                // All instruction sets must give the same samples
+                const char* check = "";
+                if (reference.empty()) reference = planar;
+                else if (reference != planar) check = "  MISMATCH";
+
+                std::cout << std::setw(8) << FORMAT_NAMES[f] << std::setw(10) << nb_channels << std::setw(10) << name
+                          << std::setw(12) << std::fixed << std::setprecision(2) << raw_size / t * 1e-9
+                          << std::setprecision(3) << t * 1e9 / samples << check << std::endl;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+// Time of Interpretor::extract_notes (selection of the strongest entries) against the previous full sort of the histogram
+// Usage : extract-bench [number of notes (default 4)]
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../src/extractor.h"
+#include "../src/interpretor.h"
+#include "../src/sort.h"
+#include "bench-histograms.h"
+
+
+static const size_t BIN_COUNTS[] = {16, 64, 128, 256, 1024, 4096, 16384, 65536};
+
+
+struct Ref {
+    float strength;
+    uint32_t index;
+
+    inline bool operator>(const Ref& other) const {
+        return strength > other.strength;
+    }
+};
+
+
+// Previous extraction : sort all the entries then read the strongest ones, return the indexes of the notes
+static size_t extract_sorted(const HistogramEntry* entries, size_t nb_entries, uint32_t* output, size_t maximum) {
+    Ref* sorted = new Ref[nb_entries];
+    for (size_t i = 0; i < nb_entries; i++) {
+        sorted[i].index = i;
+        sorted[i].strength = entries[i].value;
+    }
+
+    sort(sorted, nb_entries);
+
+    float variance = 0.f;
+    float threshold = sorted[0].strength;
+    for (size_t i = 1; i < nb_entries; i++) {
+        threshold += sorted[i].strength;
+        variance += fabsf(sorted[i].strength - sorted[i - 1].strength);
+    }
+    threshold /= nb_entries;
+    threshold += variance / (nb_entries - 1);
+
+    size_t n = 0;
+    for (size_t i = nb_entries; n < maximum && i-- > 0;) {
+        const size_t index = sorted[i].index;
+        if (entries[index].value > threshold) output[n++] = index;
+    }
+
+    delete[] sorted;
+    return n;
+}
+
+
+// Noise with a few peaks and their harmonics, some entries are equal
+static void gen_histogram(HistogramEntry* entries, size_t nb_entries) {
+    for (size_t i = 0; i < nb_entries; i++) {
+        entries[i].value = (float) rand() / RAND_MAX * .1f;
+        if (rand() % 8 == 0) entries[i].value = .05f;
+    }
+    for (int p = 0; p < 6; p++) {
+        const size_t peak = rand() % nb_entries;
+        for (size_t h = peak; h < nb_entries; h += 12) entries[h].value += (float) rand() / RAND_MAX / (1 + h - peak);
+    }
+}
+
+
+int main(int argc, char** args) {
+    const size_t nb_notes = argc > 1 ? atoi(args[1]) : 4;
+
+    std::cout << std::left << std::setw(10) << "bins" << std::setw(14) << "sort ns" << std::setw(14) << "select ns"
+              << std::setw(10) << "speedup" << "different notes" << std::endl;
+
+    for (const size_t nb_entries : BIN_COUNTS) {
+        Extractor extractor;
+        Interpretor interpretor;
+        extractor.histogram.resize(nb_entries);
+        HistogramEntry* entries = extractor.histogram.entries;
+
+        // The frequencies are all different, the notes are compared by them
+        const std::vector<HistogramEntry> histograms = bench_gen_histograms(nb_entries, [](HistogramEntry* entries, size_t n, int) {
+            gen_histogram(entries, n);
+        });
+        memcpy(entries, histograms.data(), nb_entries * sizeof(HistogramEntry));
+        interpretor.set_extractor(&extractor);
+
+        std::vector<uint32_t> indexes(nb_notes);
+        std::vector<Note> notes(nb_notes);
+        const int nb_frames = bench_nb_frames(nb_entries);
+
+        // Same notes from both extractions
+        int nb_different = 0;
+        for (int h = 0; h < BENCH_NB_HISTOGRAMS; h++) {
+            memcpy(entries, &histograms[nb_entries * h], nb_entries * sizeof(HistogramEntry));
+            const size_t n1 = extract_sorted(entries, nb_entries, indexes.data(), nb_notes);
+            const size_t n2 = interpretor.extract_notes(notes.data(), nb_notes);
+            bool same = n1 == n2;
+            for (size_t i = 0; same && i < n1; i++) same = entries[indexes[i]].freq == notes[i].freq;
+            nb_different += !same;
+        }
+
+        size_t total = 0;
+        const double t_sort = bench_ns_per_frame(entries, histograms, nb_entries, nb_frames, [&]() {
+            total += extract_sorted(entries, nb_entries, indexes.data(), nb_notes);
+        });
+        const double t_select = bench_ns_per_frame(entries, histograms, nb_entries, nb_frames, [&]() {
+            total += interpretor.extract_notes(notes.data(), nb_notes);
+        });
+
+        std::cout << std::setw(10) << nb_entries << std::setw(14) << std::fixed << std::setprecision(0) << t_sort
+                  << std::setw(14) << t_select << std::setw(10) << std::setprecision(1) << t_sort / t_select
+                  << nb_different << "/" << BENCH_NB_HISTOGRAMS << (total == 0 ? " (no notes)" : "") << std::endl;
+    }
+
+    return 0;
+}
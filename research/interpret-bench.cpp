@@ -0,0 +1,110 @@
+// Time to interpret an hour of histograms frame by frame (extract_notes) and at once (extract_notes_batch)
+// Usage : interpret-bench [frames per second (default 12)]
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../src/extractor.h"
+#include "../src/interpretor.h"
+
+
+static const size_t BIN_COUNTS[] = {96, 1000};
+
+constexpr double DURATION = 3600.; // Seconds of audio
+constexpr size_t NB_NOTES = 4;
+
+
+struct Pipeline {
+    const char* name;
+    uint32_t stages;
+    InterpretorSmoothing smoothing;
+    double threshold_window; // In seconds
+};
+
+static const Pipeline PIPELINES[] = {
+    {"human hear", STAGE_HUMAN_HEAR, SMOOTHING_NONE, 0.},
+    {"all stages", STAGE_SMOOTH | STAGE_HUMAN_HEAR | STAGE_HARMONY | STAGE_PEEKS, SMOOTHING_MEDIAN, 5.},
+};
+
+
+// Noise with a few peaks and their harmonics
+static void gen_histogram(float* values, size_t nb_entries) {
+    for (size_t i = 0; i < nb_entries; i++) values[i] = (float) rand() / RAND_MAX * .1f;
+    for (int p = 0; p < 3; p++) {
+        const size_t peak = rand() % nb_entries;
+        for (size_t h = peak; h < nb_entries; h += 12) values[h] += (float) rand() / RAND_MAX / (1 + h - peak);
+    }
+}
+
+
+int main(int argc, char** args) {
+    const double fps = argc > 1 ? atof(args[1]) : 12.;
+    const size_t nb_frames = (size_t) (DURATION * fps);
+    ThreadPool& pool = ThreadPool::shared();
+
+    std::cout << nb_frames << " frames (an hour at " << fps << " fps), " << pool.get_nb_threads() << " threads" << std::endl;
+    std::cout << std::left << std::setw(8) << "bins" << std::setw(14) << "stages" << std::setw(14) << "per frame s"
+              << std::setw(12) << "batch s" << std::setw(10) << "speedup" << "different frames" << std::endl;
+
+    for (const size_t nb_entries : BIN_COUNTS) {
+        std::vector<float> histograms(nb_frames * nb_entries);
+        for (size_t f = 0; f < nb_frames; f++) gen_histogram(&histograms[f * nb_entries], nb_entries);
+
+        for (const Pipeline& pipeline : PIPELINES) {
+            Extractor extractor;
+            extractor.histogram.resize(nb_entries);
+            HistogramEntry* entries = extractor.histogram.entries;
+            for (size_t i = 0; i < nb_entries; i++) entries[i].freq = 20.f * powf(1.0594631f, i % 96);
+
+            Interpretor live, batch;
+            for (Interpretor* interpretor : {&live, &batch}) {
+                interpretor->set_extractor(&extractor);
+                interpretor->set_smoothing(pipeline.smoothing, 3. / fps, fps);
+                interpretor->set_threshold_window(pipeline.threshold_window, fps);
+            }
+
+            std::vector<Note> live_notes(nb_frames * NB_NOTES);
+            std::vector<size_t> live_counts(nb_frames);
+            auto start = std::chrono::steady_clock::now();
+            for (size_t f = 0; f < nb_frames; f++) {
+                for (size_t i = 0; i < nb_entries; i++) entries[i].value = histograms[f * nb_entries + i];
+                if (pipeline.stages & STAGE_SMOOTH) live.smooth();
+                if (pipeline.stages & STAGE_HUMAN_HEAR) live.adjust_to_human_hear();
+                if (pipeline.stages & STAGE_HARMONY) live.keep_harmony();
+                if (pipeline.stages & STAGE_PEEKS) live.keep_peeks();
+                live_counts[f] = live.extract_notes(&live_notes[f * NB_NOTES], NB_NOTES);
+            }
+            const double t_live = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            std::vector<float> strengths = histograms;
+            std::vector<Note> batch_notes(nb_frames * NB_NOTES);
+            std::vector<size_t> batch_counts(nb_frames);
+            start = std::chrono::steady_clock::now();
+            batch.extract_notes_batch(strengths.data(), nb_frames, pipeline.stages, batch_notes.data(), batch_counts.data(), NB_NOTES, pool);
+            const double t_batch = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            // Same notes from both
+            size_t nb_different = 0;
+            for (size_t f = 0; f < nb_frames; f++) {
+                bool same = live_counts[f] == batch_counts[f];
+                for (size_t i = 0; same && i < live_counts[f]; i++) {
+                    same = live_notes[f * NB_NOTES + i].freq == batch_notes[f * NB_NOTES + i].freq
+                        && live_notes[f * NB_NOTES + i].strength == batch_notes[f * NB_NOTES + i].strength;
+                }
+                nb_different += !same;
+            }
+
+            std::cout << std::setw(8) << nb_entries << std::setw(14) << pipeline.name << std::fixed << std::setprecision(3)
+                      << std::setw(14) << t_live << std::setw(12) << t_batch << std::setw(10) << std::setprecision(1)
+                      << t_live / t_batch << nb_different << "/" << nb_frames << std::endl;
+        }
+    }
+
+    return 0;
+}
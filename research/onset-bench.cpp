@@ -0,0 +1,163 @@
+// Onsets found by the OnsetDetector with fixed hops and with adaptive hops on a synthetic melody
+// Each frame runs the loop of main (detector, then smoothing, human hear and notes tracked by a NoteTracker)
+// Frames counts every histogram computed by the extractor (including the ones locating the onsets), starts the notes
+// started by the tracker
+// Usage : onset-bench [duration in seconds (default 120)]
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../src/audio.h"
+#include "../src/extractor.h"
+#include "../src/interpretor.h"
+#include "../src/note_tracker.h"
+#include "../src/onset_detector.h"
+
+
+constexpr int32_t RATE = 22050;
+constexpr double WINDOW_WIDTH = 1. / 8.; // Of the extractor, like in the main loop
+constexpr int NB_NOTES = 4; // Notes of each frame, like in the main loop
+constexpr double TOLERANCE = .1; // Onsets found further from a true one are false
+
+static const double NOTE_DURATIONS[] = {.125, .25, .25, .5, .5, 1., 2.};
+
+
+struct Method {
+    const char* name;
+    double min_hop;
+    double max_hop;
+};
+
+static const Method METHODS[] = {
+    {"fixed 1/12", 1. / 12., 1. / 12.},
+    {"fixed 1/24", 1. / 24., 1. / 24.},
+    {"fixed 1/48", 1. / 48., 1. / 48.},
+    {"adaptive", 1. / 48., 1. / 12.},
+    {"adaptive", 1. / 48., 1. / 8.},
+    {"adaptive", 1. / 48., 1. / 6.},
+};
+
+
+// Melody of notes with their harmonics (one note at a time, some rests), return the onsets
+static std::vector<double> gen_melody(std::vector<int16_t>* samples, double duration) {
+    std::vector<double> onsets;
+    samples->assign((size_t) (duration * RATE), 0);
+    double t = .5;
+    while (t < duration - 2.) {
+        const double length = NOTE_DURATIONS[rand() % (sizeof(NOTE_DURATIONS) / sizeof(NOTE_DURATIONS[0]))];
+        const double freq = 440. * pow(2., (rand() % 36 - 24) / 12.);
+        if (rand() % 8 != 0) {
+            onsets.push_back(t);
+            const size_t start = (size_t) (t * RATE);
+            const size_t n = (size_t) (length * RATE);
+            for (size_t i = 0; i < n; i++) {
+                const double x = (double) i / RATE;
+                const double envelope = std::min(x / .005, 1.) * exp(-x * 1.5) * std::min((length - x) / .01, 1.);
+                double v = 0.;
+                for (int k = 1; k <= 4; k++) v += sin(2. * M_PI * freq * k * x) / k;
+                (*samples)[start + i] += (int16_t) (v * envelope * 6000.);
+            }
+        }
+        t += length;
+    }
+    return onsets;
+}
+
+
+// 16 bits mono WAV file in memory
+static std::vector<uint8_t> gen_wav(const std::vector<int16_t>& samples) {
+    const uint32_t data_size = (uint32_t) (samples.size() * 2);
+    std::vector<uint8_t> wav(44 + data_size);
+    uint8_t* p = wav.data();
+    auto put32 = [&](uint32_t v) { memcpy(p, &v, 4); p += 4; };
+    auto put16 = [&](uint16_t v) { memcpy(p, &v, 2); p += 2; };
+    memcpy(p, "RIFF", 4); p += 4; put32(36 + data_size);
+    memcpy(p, "WAVEfmt ", 8); p += 8; put32(16); put16(1); put16(1); put32(RATE); put32(RATE * 2); put16(2); put16(16);
+    memcpy(p, "data", 4); p += 4; put32(data_size);
+    memcpy(p, samples.data(), data_size);
+    return wav;
+}
+
+
+int main(int argc, char** args) {
+    const double duration = argc > 1 ? atof(args[1]) : 120.;
+
+    std::vector<int16_t> samples;
+    const std::vector<double> onsets = gen_melody(&samples, duration);
+    const std::vector<uint8_t> wav = gen_wav(samples);
+
+    std::cout << onsets.size() << " onsets in " << duration << "s" << std::endl;
+    std::cout << std::left << std::setw(12) << "method" << std::setw(14) << "hops" << std::setw(14) << "frames/s"
+              << std::setw(10) << "recall" << std::setw(12) << "precision" << std::setw(16) << "mean error ms" << "starts" << std::endl;
+
+    for (const Method& method : METHODS) {
+        Audio audio;
+        if (audio.load_file_data(wav.data(), wav.size())) return EXIT_FAILURE;
+        Extractor extractor;
+        extractor.set_audio(&audio);
+        extractor.set_window_width((float) WINDOW_WIDTH);
+        extractor.set_freq_domain(20, 5000);
+
+        OnsetDetector detector;
+        detector.set_hops(method.min_hop, method.max_hop);
+        detector.set_window_width(WINDOW_WIDTH);
+
+        Interpretor interpretor;
+        interpretor.set_extractor(&extractor);
+        interpretor.set_smoothing(SMOOTHING_MEDIAN, 3. * method.min_hop, 1. / method.min_hop); // 3 frames like in the main loop
+
+        NoteTracker tracker(NB_NOTES);
+        tracker.set_min_duration(.5 * WINDOW_WIDTH);
+        tracker.set_min_cut(.5 * WINDOW_WIDTH);
+        std::vector<NoteEvent> events(tracker.get_max_events());
+        Note notes[NB_NOTES];
+
+        std::vector<double> found;
+        int64_t nb_frames = 0;
+        int64_t nb_starts = 0;
+        while (extractor.get_cursor() < duration) {
+            nb_frames++;
+            if (detector.update(&extractor)) found.push_back(detector.get_onset_time());
+
+            interpretor.smooth();
+            interpretor.adjust_to_human_hear();
+            const size_t n = interpretor.extract_notes(notes, NB_NOTES);
+            const size_t nb_events = tracker.update(notes, n, extractor.get_cursor(), events.data());
+            for (size_t e = 0; e < nb_events; e++) nb_starts += events[e].type == NOTE_START;
+
+            extractor.forward(detector.get_hop());
+        }
+        nb_frames += detector.get_nb_refine_analyses();
+
+        // Each true onset matches the closest onset found within the tolerance
+        size_t nb_matched = 0;
+        double error = 0.;
+        std::vector<bool> used(found.size(), false);
+        for (const double onset : onsets) {
+            size_t best = found.size();
+            for (size_t i = 0; i < found.size(); i++) {
+                if (!used[i] && fabs(found[i] - onset) <= TOLERANCE && (best == found.size() || fabs(found[i] - onset) < fabs(found[best] - onset))) best = i;
+            }
+            if (best < found.size()) {
+                used[best] = true;
+                nb_matched++;
+                error += fabs(found[best] - onset);
+            }
+        }
+
+        std::cout << std::setw(12) << method.name << std::setw(14)
+                  << ("1/" + std::to_string((int) lround(1. / method.min_hop)) + "-1/" + std::to_string((int) lround(1. / method.max_hop)))
+                  << std::fixed << std::setprecision(1) << std::setw(14) << nb_frames / duration << std::setprecision(3)
+                  << std::setw(10) << (double) nb_matched / onsets.size() << std::setw(12) << (found.empty() ? 0. : (double) nb_matched / found.size())
+                  << std::setprecision(1) << std::setw(16) << (nb_matched ? error / nb_matched * 1e3 : 0.) << nb_starts << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,126 @@
+// Time of Interpretor::keep_peeks (one SIMD pass in place) against a scalar pass reading a copy of the strengths
+// Also counts the notes extracted next to another note (clusters made by broad humps) without and with the peeks
+// Usage : peek-bench [prominence (default 0)]
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../src/extractor.h"
+#include "../src/interpretor.h"
+#include "bench-histograms.h"
+
+
+static const size_t BIN_COUNTS[] = {96, 1000, 10000};
+static const size_t NEIGHBOURHOODS[] = {1, 3, 8};
+
+constexpr size_t NB_NOTES = 8;
+
+
+// Noise with a few broad humps
+static void gen_histogram(HistogramEntry* entries, size_t nb_entries) {
+    for (size_t i = 0; i < nb_entries; i++) entries[i].value = (float) rand() / RAND_MAX * .1f;
+    for (int h = 0; h < 4; h++) {
+        const size_t center = rand() % nb_entries;
+        const float strength = .5f + (float) rand() / RAND_MAX;
+        for (size_t i = center > 4 ? center - 4 : 0; i < nb_entries && i <= center + 4; i++) {
+            const float d = (float) i - center;
+            entries[i].value += strength / (1.f + d * d / 4.f);
+        }
+    }
+}
+
+
+// Reference : keep the entries stronger than their neighbours, reading a copy of the strengths
+static void keep_peeks_scalar(HistogramEntry* entries, size_t nb_entries, float* copy, size_t neighbourhood, float prominence) {
+    for (size_t i = 0; i < nb_entries; i++) copy[i] = entries[i].value;
+    for (size_t i = 0; i < nb_entries; i++) {
+        const float value = copy[i];
+        float lowest = value;
+        bool peek = true;
+        for (size_t j = i > neighbourhood ? i - neighbourhood : 0; j < i; j++) {
+            peek &= copy[j] < value;
+            lowest = fminf(lowest, copy[j]);
+        }
+        for (size_t j = i + 1; j < nb_entries && j <= i + neighbourhood; j++) {
+            peek &= copy[j] <= value;
+            lowest = fminf(lowest, copy[j]);
+        }
+        if (!peek || value * (1.f - prominence) < lowest) entries[i].value = 0.f;
+    }
+}
+
+
+// Notes of a frame whose entry is next to the entry of another note (entries spaced by a log_step of log frequency)
+static int count_adjacent(const Note* notes, size_t n, float log_step) {
+    int count = 0;
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = 0; j < n; j++) {
+            if (i != j && fabsf(logf(notes[i].freq / notes[j].freq)) < 1.5f * log_step) {
+                count++;
+                break;
+            }
+        }
+    }
+    return count;
+}
+
+
+int main(int argc, char** args) {
+    const float prominence = argc > 1 ? atof(args[1]) : 0.f;
+
+    std::cout << std::left << std::setw(8) << "bins" << std::setw(8) << "around" << std::setw(12) << "scalar ns"
+              << std::setw(12) << "simd ns" << std::setw(10) << "speedup" << "adjacent notes (without -> with)" << std::endl;
+
+    for (const size_t nb_entries : BIN_COUNTS) {
+        const std::vector<HistogramEntry> histograms = bench_gen_histograms(nb_entries, [](HistogramEntry* entries, size_t n, int) {
+            gen_histogram(entries, n);
+        });
+        std::vector<float> copy(nb_entries);
+        const float log_step = logf(BENCH_MAX_FREQ / BENCH_MIN_FREQ) / nb_entries;
+        const int nb_frames = bench_nb_frames(nb_entries);
+
+        for (const size_t neighbourhood : NEIGHBOURHOODS) {
+            Extractor extractor;
+            Interpretor interpretor;
+            extractor.histogram.resize(nb_entries);
+            HistogramEntry* entries = extractor.histogram.entries;
+            memcpy(entries, histograms.data(), nb_entries * sizeof(HistogramEntry));
+            interpretor.set_extractor(&extractor);
+            interpretor.set_peeks(neighbourhood, prominence);
+
+            // Same peeks from both passes, and the clusters of notes they remove
+            int nb_different = 0, adjacent_without = 0, adjacent_with = 0;
+            Note notes[NB_NOTES];
+            std::vector<HistogramEntry> expected(nb_entries);
+            for (int h = 0; h < BENCH_NB_HISTOGRAMS; h++) {
+                memcpy(entries, &histograms[nb_entries * h], nb_entries * sizeof(HistogramEntry));
+                adjacent_without += count_adjacent(notes, interpretor.extract_notes(notes, NB_NOTES), log_step);
+
+                memcpy(expected.data(), entries, nb_entries * sizeof(HistogramEntry));
+                keep_peeks_scalar(expected.data(), nb_entries, copy.data(), neighbourhood, prominence);
+                interpretor.keep_peeks();
+                nb_different += memcmp(expected.data(), entries, nb_entries * sizeof(HistogramEntry)) != 0;
+                adjacent_with += count_adjacent(notes, interpretor.extract_notes(notes, NB_NOTES), log_step);
+            }
+
+            const double t_scalar = bench_ns_per_frame(entries, histograms, nb_entries, nb_frames, [&]() {
+                keep_peeks_scalar(entries, nb_entries, copy.data(), neighbourhood, prominence);
+            });
+            const double t_simd = bench_ns_per_frame(entries, histograms, nb_entries, nb_frames, [&]() {
+                interpretor.keep_peeks();
+            });
+
+            std::cout << std::setw(8) << nb_entries << std::setw(8) << neighbourhood << std::setw(12) << std::fixed
+                      << std::setprecision(0) << t_scalar << std::setw(12) << t_simd << std::setw(10) << std::setprecision(1)
+                      << t_scalar / t_simd << adjacent_without << " -> " << adjacent_with
+                      << (nb_different ? " (DIFFERENT PEEKS)" : "") << std::endl;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,55 @@
+// Time of Interpretor::smooth (running median or exponential average of the strengths of each entry)
+// The median must cost O(entries x log(window)) per frame
+// Usage : smooth-bench
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../src/extractor.h"
+#include "../src/interpretor.h"
+#include "bench-histograms.h"
+
+
+static const size_t BIN_COUNTS[] = {96, 1000, 10000};
+static const size_t WINDOWS[] = {3, 12, 50, 200}; // In frames
+
+
+int main() {
+    std::cout << std::left << std::setw(8) << "bins" << std::setw(10) << "window" << std::setw(14) << "median ns"
+              << std::setw(14) << "median fps" << std::setw(14) << "exp ns" << "exp fps" << std::endl;
+
+    for (const size_t nb_entries : BIN_COUNTS) {
+        // Noise with a few peaks
+        const std::vector<HistogramEntry> histograms = bench_gen_histograms(nb_entries, [](HistogramEntry* entries, size_t n, int) {
+            bench_gen_peaks(entries, n, 4);
+        });
+
+        for (const size_t window : WINDOWS) {
+            double times[2];
+            const int nb_frames = bench_nb_frames(nb_entries, BENCH_NB_HISTOGRAMS + window);
+
+            for (int s = 0; s < 2; s++) {
+                Extractor extractor;
+                Interpretor interpretor;
+                extractor.histogram.resize(nb_entries);
+                HistogramEntry* entries = extractor.histogram.entries;
+                memcpy(entries, histograms.data(), nb_entries * sizeof(HistogramEntry));
+                interpretor.set_extractor(&extractor);
+                interpretor.set_smoothing(s == 0 ? SMOOTHING_MEDIAN : SMOOTHING_EXPONENTIAL, (double) window, 1.);
+
+                times[s] = bench_ns_per_frame(entries, histograms, nb_entries, nb_frames, [&]() { interpretor.smooth(); });
+            }
+
+            std::cout << std::setw(8) << nb_entries << std::setw(10) << window << std::fixed << std::setprecision(0)
+                      << std::setw(14) << times[0] << std::setw(14) << 1e9 / times[0]
+                      << std::setw(14) << times[1] << 1e9 / times[1] << std::endl;
+        }
+    }
+
+    return 0;
+}
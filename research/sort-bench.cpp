@@ -0,0 +1,192 @@
+// Time of sort() (merge sort, and sorting networks or radix sort of the elements with a sort key) against the standard sorts
+// and pdqsort (if pdqsort.h is in the include path) for several distributions of the data
+// Elements are like the histogram entries ranked by the interpretor : a float strength and an index
+// Then the scaling of parallel_sort() with the number of threads on the largest random array
+// Usage : sort-bench [maximum size (default 10000000)]
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <stdint.h>
+#include <stdlib.h>
+#include <thread>
+
+#include "../src/sort.h"
+#include "../src/thread_pool.h"
+
+#if __has_include(<pdqsort.h>)
+#include <pdqsort.h>
+#define HAS_PDQSORT 1
+#else
+#define HAS_PDQSORT 0
+#endif
+
+
+// Merge sorted by sort()
+struct Entry {
+    float strength;
+    uint32_t index;
+
+    inline bool operator>(const Entry& other) const {
+        return strength > other.strength;
+    }
+};
+
+// Sorted by networks (short arrays with AVX2) or radix sorted by sort()
+struct KeyedEntry {
+    float strength;
+    uint32_t index;
+
+    inline bool operator>(const KeyedEntry& other) const {
+        return strength > other.strength;
+    }
+
+    inline float sort_key() const {
+        return strength;
+    }
+};
+
+
+enum Distribution {
+    DIST_RANDOM,
+    DIST_NEARLY_SORTED, // 1% of the elements moved
+    DIST_REVERSED,
+    DIST_FEW_UNIQUE, // 16 different values
+    NB_DISTS
+};
+
+static const char* DIST_NAMES[] = {"random", "nearly", "reversed", "few-uniq"};
+
+static const size_t SIZES[] = {16, 64, 96, 256, 1024, 4096, 16384, 65536, 262144, 1 << 20, 10000000};
+
+constexpr size_t MIN_ELEMENTS_SORTED = 1 << 24; // Small arrays are sorted again until this many elements were sorted
+
+
+static std::vector<float> gen_strengths(size_t n, Distribution dist, std::mt19937& rng) {
+    std::vector<float> v(n);
+    std::uniform_real_distribution<float> uniform(0.f, 1.f);
+    for (size_t i = 0; i < n; i++) v[i] = uniform(rng);
+
+    switch (dist) {
+    case DIST_NEARLY_SORTED:
+        std::sort(v.begin(), v.end());
+        for (size_t k = 0; k < n / 100 + 1; k++) std::swap(v[rng() % n], v[rng() % n]);
+        break;
+    case DIST_REVERSED:
+        std::sort(v.begin(), v.end(), [](float a, float b) { return a > b; });
+        break;
+    case DIST_FEW_UNIQUE:
+        for (size_t i = 0; i < n; i++) v[i] = (float) (rng() % 16);
+        break;
+    default:
+        break;
+    }
+    return v;
+}
+
+
+// Best time per element in nanoseconds, the sorted elements are left in out
+template<typename T, typename F>
+static double bench(const std::vector<float>& strengths, std::vector<T>& out, F sort_fn) {
+    const size_t n = strengths.size();
+    const int repeat = (int) std::max<size_t>(MIN_ELEMENTS_SORTED / n / 4, 1);
+    std::vector<T> data(n);
+
+    double best = 1e30;
+    for (int k = 0; k < 3; k++) {
+        double total = 0.;
+        for (int r = 0; r < repeat; r++) {
+            for (size_t i = 0; i < n; i++) data[i] = T {strengths[i], (uint32_t) i};
+            const auto start = std::chrono::steady_clock::now();
+            sort_fn(data.data(), n);
+            total += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        }
+        best = std::min(best, total / repeat / n);
+    }
+
+    out = std::move(data);
+    return best;
+}
+
+
+template<typename T>
+static bool same_order(const std::vector<T>& a, const std::vector<Entry>& b) {
+    for (size_t i = 0; i < a.size(); i++) if (a[i].index != b[i].index) return false;
+    return true;
+}
+
+
+template<typename T>
+static bool is_sorted(const std::vector<T>& a) {
+    for (size_t i = 1; i < a.size(); i++) if (a[i - 1] > a[i]) return false;
+    return true;
+}
+
+
+int main(int argc, char** args) {
+    const size_t max_size = argc > 1 ? atol(args[1]) : 10000000;
+    std::mt19937 rng(42);
+
+    if (!HAS_PDQSORT) std::cout << "pdqsort.h not found, pdqsort isn't measured" << std::endl;
+
+    std::cout << std::left << std::setw(10) << "data" << std::setw(10) << "size" << std::setw(10) << "merge" << std::setw(10) << "keyed"
+              << std::setw(11) << "std::sort" << std::setw(13) << "std::stable" << std::setw(10) << "pdqsort" << "(ns per element)" << std::endl;
+
+    const auto less = [](const Entry& a, const Entry& b) { return b > a; };
+
+    for (int dist = 0; dist < NB_DISTS; dist++) {
+        for (const size_t n : SIZES) {
+            if (n > max_size) break;
+
+            const std::vector<float> strengths = gen_strengths(n, (Distribution) dist, rng);
+
+            std::vector<Entry> merged, std_sorted, reference, pdq_sorted;
+            std::vector<KeyedEntry> keyed;
+            const double t_merge = bench(strengths, merged, [](Entry* d, size_t len) { sort(d, len); });
+            const double t_keyed = bench(strengths, keyed, [](KeyedEntry* d, size_t len) { sort(d, len); });
+            const double t_std = bench(strengths, std_sorted, [&](Entry* d, size_t len) { std::sort(d, d + len, less); });
+            const double t_stable = bench(strengths, reference, [&](Entry* d, size_t len) { std::stable_sort(d, d + len, less); });
+#if HAS_PDQSORT
+            const double t_pdq = bench(strengths, pdq_sorted, [&](Entry* d, size_t len) { pdqsort(d, d + len, less); });
+            const bool pdq_ok = is_sorted(pdq_sorted);
+#else
+            const double t_pdq = 0.;
+            const bool pdq_ok = true;
+#endif
+
+            // sort() is stable, both paths must give the order of std::stable_sort
+            const bool ok = same_order(merged, reference) && same_order(keyed, reference) && is_sorted(std_sorted) && pdq_ok;
+
+            std::cout << std::setw(10) << DIST_NAMES[dist] << std::setw(10) << n << std::fixed << std::setprecision(2)
+                      << std::setw(10) << t_merge << std::setw(10) << t_keyed << std::setw(11) << t_std << std::setw(13) << t_stable;
+            if (HAS_PDQSORT) std::cout << std::setw(10) << t_pdq;
+            else std::cout << std::setw(10) << "-";
+            std::cout << (ok ? "" : "MISMATCH") << std::endl;
+        }
+    }
+
+    // Scaling of the parallel sort, up to the number of cores
+    size_t n = 0;
+    for (const size_t size : SIZES) if (size <= max_size) n = size;
+    const std::vector<float> strengths = gen_strengths(n, DIST_RANDOM, rng);
+    std::vector<Entry> reference;
+    bench(strengths, reference, [&](Entry* d, size_t len) { std::stable_sort(d, d + len, less); });
+
+    std::cout << std::endl << std::setw(10) << "threads" << std::setw(10) << "parallel" << "speedup (" << n << " random elements)" << std::endl;
+    const int32_t nb_cores = std::max<int32_t>(std::thread::hardware_concurrency(), 1);
+    double t_single = 0.;
+    for (int32_t k = 1; k < 2 * nb_cores; k *= 2) {
+        const int32_t nb_threads = std::min(k, nb_cores);
+        ThreadPool pool(nb_threads);
+        std::vector<Entry> sorted;
+        const double t = bench(strengths, sorted, [&](Entry* d, size_t len) { parallel_sort(d, len, pool); });
+        if (nb_threads == 1) t_single = t;
+
+        std::cout << std::setw(10) << nb_threads << std::setw(10) << t << t_single / t << (same_order(sorted, reference) ? "" : " MISMATCH") << std::endl;
+    }
+
+    return 0;
+}
@@ -11,7 +11,7 @@ public:
     float freq;
     float strength;
 
-    inline bool operator>(const MyType& other) {
+    inline bool operator>(const MyType& other) const {
         return strength > other.strength;
     }
 };
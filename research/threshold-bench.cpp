@@ -0,0 +1,56 @@
+// Time of Interpretor::extract_notes with a threshold adapted to the last seconds (sliding statistics of the strengths)
+// The cost of a frame must not depend on the length of the window
+// Usage : threshold-bench [frames per second (default 12)]
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/extractor.h"
+#include "../src/interpretor.h"
+#include "bench-histograms.h"
+
+
+static const size_t BIN_COUNTS[] = {96, 1024};
+static const double WINDOWS[] = {0., 1., 5., 30.}; // In seconds, 0 for the threshold of the current frame only
+
+constexpr size_t NB_NOTES = 4;
+
+
+int main(int argc, char** args) {
+    const double fps = argc > 1 ? atof(args[1]) : 12.;
+
+    std::cout << std::left << std::setw(10) << "bins" << std::setw(10) << "window" << std::setw(14) << "ns per frame" << "notes" << std::endl;
+
+    for (const size_t nb_entries : BIN_COUNTS) {
+        // Quiet and loud parts
+        const std::vector<HistogramEntry> histograms = bench_gen_histograms(nb_entries, [](HistogramEntry* entries, size_t n, int h) {
+            bench_gen_peaks(entries, n, 4, h % 16 < 8 ? 1.f : .1f);
+        });
+        const int nb_frames = bench_nb_frames(nb_entries);
+
+        for (const double window : WINDOWS) {
+            Extractor extractor;
+            Interpretor interpretor;
+            extractor.histogram.resize(nb_entries);
+            HistogramEntry* entries = extractor.histogram.entries;
+            memcpy(entries, histograms.data(), nb_entries * sizeof(HistogramEntry));
+            interpretor.set_extractor(&extractor);
+            interpretor.set_threshold_window(window, fps);
+
+            Note notes[NB_NOTES];
+            size_t total = 0;
+            const double ns = bench_ns_per_frame(entries, histograms, nb_entries, nb_frames, [&]() {
+                total += interpretor.extract_notes(notes, NB_NOTES);
+            });
+
+            std::cout << std::setw(10) << nb_entries << std::setw(10) << window << std::setw(14) << std::fixed << std::setprecision(0)
+                      << ns << std::setprecision(2) << (double) total / nb_frames << std::endl;
+        }
+    }
+
+    return 0;
+}
@@ -1,187 +1,1009 @@
 #include "audio.h"
 
+#include "convert.h"
+#include "flac.h"
+#include "resampler.h"
+#include "simd.h"
+#include "thread_pool.h"
 #include "utils.h"
+#include "wav.h"
+
+#include <string.h>
+#include <thread>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+struct AudioStream {
+    FILE* file = nullptr;
+
+    // WAV files
+    int64_t data_offset = 0;
+    int64_t file_pos = 0;
+    int32_t block_align = 0;
+    uint8_t* raw = nullptr; // Interleaved samples of the block being read
+
+    // FLAC files
+    flac_info_t flac_info;
+    FlacReader* flac = nullptr;
+
+    std::thread thread;
+    std::atomic<int64_t> want_first = 0; // Blocks required by the last call to require()
+    std::atomic<int64_t> want_last = 1;
+    std::atomic<int64_t> extra_first = 0; // Blocks required by the last call to prefetch()
+    std::atomic<int64_t> extra_last = 0;
+    int64_t nb_resident = 0;
+    bool stop = false;
+};
+
+
+struct AudioDecoder {
+    FILE* file;
+    flac_info_t info;
+    FlacReader* reader;
+};
+
+
+Audio::Audio() {
+    data = nullptr;
+    all_data = nullptr;
+    all_data_size = 0;
+    mapping = nullptr;
+    mapping_size = 0;
+    source = nullptr;
+    source_format = PCM_F32;
+    source_nb_channels = 0;
+    mix_weights = nullptr;
+    blocks = nullptr;
+    nb_blocks = 0;
+    stream = nullptr;
+    blocks_used = nullptr;
+    use_clock = 0;
+    nb_resident = 0;
+    max_resident = AUDIO_LAZY_MAX_BLOCKS;
+    decoder = nullptr;
+    resampled_from = nullptr;
+    resampler = nullptr;
+    length = 0;
+    rate = 0;
+    nb_channels = 0;
+    format = SAMPLE_FMT_FLOAT32;
+    guard = 0;
+}
+
+
+Audio::~Audio() {
+    close();
+    free_channels();
+    free(data);
+}
+
+
+#ifdef _WIN32
+
+static void* alloc_pages(size_t size) {
+    void* ptr = aligned_malloc(size, AUDIO_ALIGNMENT);
+    if (ptr) memset(ptr, 0, size);
+    return ptr;
+}
+
+static void free_pages(void* ptr, size_t size) {
+    aligned_free(ptr);
+}
 
+static void release_pages(void* ptr, size_t size) {}
 
-#define AUDIO_FMT_PCM_INT 1
-#define AUDIO_FMT_PCM_FLOAT 3
+#else
 
+// Anonymous pages are zeroed and only use memory once written
+static void* alloc_pages(size_t size) {
+    void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return ptr == MAP_FAILED ? nullptr : ptr;
+}
+
+static void free_pages(void* ptr, size_t size) {
+    if (ptr) munmap(ptr, size);
+}
+
+// Give back the memory of the whole pages inside the range (they are read as zeros afterward)
+static void release_pages(void* ptr, size_t size) {
+    const uintptr_t page = sysconf(_SC_PAGESIZE);
+    const uintptr_t start = align_up((uintptr_t) ptr, page);
+    const uintptr_t end = ((uintptr_t) ptr + size) / page * page;
+    if (end > start) madvise((void*) start, end - start, MADV_DONTNEED);
+}
+
+#endif
+
+
+static size_t sample_size(SampleFormat format) {
+    return format == SAMPLE_FMT_INT16 ? sizeof(int16_t) : sizeof(float);
+}
 
-typedef struct {
-    uint32_t frequency;
-    uint8_t sample_width;
-    uint8_t nb_channels;
-    uint32_t nb_samples;
-    uint16_t format;
-    void* data;
-} raw_music_t;
 
+static int wav_pcm_format(const wav_info_t* info, PcmFormat* format) {
+    if (info->nb_channels == 0 || info->nb_channels > PCM_MAX_CHANNELS) return 35;
 
-static int load_raw_wav_file(const char* filename, raw_music_t *music) {
-    FILE* file = fopen(filename, "rb");
+    if (info->format == WAV_FMT_PCM_FLOAT) {
+        switch (info->sample_width) {
+            case 32: *format = PCM_F32; break;
+            case 64: *format = PCM_F64; break;
+            default: return 34;
+        }
+    }
+    else if (info->format == WAV_FMT_PCM_INT) {
+        switch (info->sample_width) {
+            case 8:  *format = PCM_U8; break;
+            case 16: *format = PCM_S16; break;
+            case 24: *format = PCM_S24; break;
+            case 32: *format = PCM_S32; break;
+            default: return 33;
+        }
+    }
+    else {
+        return 32;
+    }
+
+    // Samples are packed in frames
+    if (info->block_align != info->nb_channels * pcm_sample_size(*format)) return 36;
+
+    return 0;
+}
+
+
+static int64_t guard_length(int32_t rate, SampleFormat format) {
+    const size_t align_samples = AUDIO_ALIGNMENT / sample_size(format);
+    return align_up((size_t) ceilf((float) rate / AUDIO_GUARD_MIN_FREQ), align_samples);
+}
+
+
+// Open a WAV file and parse its header, the file is left at the begining of the samples
+static FILE* open_wav_file(std::string filename, wav_info_t* info, PcmFormat* format, int* error) {
+    FILE* file = fopen(filename.c_str(), "rb");
     if (file == NULL) {
-        return 1;
+        *error = 1;
+        return NULL;
     }
 
-    #pragma pack(push,1)
+    int r = wav_parse_header(file, info);
+    if (r == 0) r = wav_pcm_format(info, format);
 
-    struct {
-        char fingerprint[4];
-        uint32_t file_size;
-        char file_format_id[4];
-    } hdr_file;
+    // Truncated files are read up to their end
+    if (r == 0) {
+        const int64_t data_offset = file_tell(file);
+        if (file_seek(file, 0, SEEK_END)) r = 13;
+        info->data_size = min<int64_t>(info->data_size, file_tell(file) - data_offset);
+        if (file_seek(file, data_offset, SEEK_SET)) r = 13;
+    }
 
-    struct {
-        uint32_t block_size;
-        uint16_t audio_format;
-        uint16_t nb_channels;
-        uint32_t frequency;
-        uint32_t bytes_per_sec;
-        uint16_t bytes_per_block;
-        uint16_t bits_per_sample;
-    } hdr_fmt;
+    if (r) {
+        fclose(file);
+        *error = r;
+        return NULL;
+    }
 
-    struct {
-        uint32_t data_size;
-        void* data;
-    } hdr_data;
+    wav_print_info(info);
 
-    #pragma pack(pop)
+    *error = 0;
+    return file;
+}
 
-    if (fread(&hdr_file, 1, sizeof(hdr_file), file) != sizeof(hdr_file)) {
-        return 2;
+
+// Open a FLAC file and parse its header, the file is left at the first frame
+static FILE* open_flac_file(std::string filename, flac_info_t* info, int* error) {
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (file == NULL) {
+        *error = 1;
+        return NULL;
     }
 
-    char* fgp = hdr_file.fingerprint;
-    if (fgp[0] != 'R' || fgp[1] != 'I' || fgp[2] != 'F' || fgp[3] != 'F') {
-        return 3;
+    const int r = flac_parse_header(file, info);
+    if (r) {
+        fclose(file);
+        *error = r;
+        return NULL;
     }
 
-    char* ffid = hdr_file.file_format_id;
-    if (ffid[0] != 'W' || ffid[1] != 'A' || ffid[2] != 'V' || ffid[3] != 'E') {
-        return 4;
+    flac_print_info(info);
+
+    *error = 0;
+    return file;
+}
+
+
+// Allocate all channels in one block, each one aligned and surrounded by zeroed guards
+// so analysis can read around the begin and the end of the audio without bound checks
+void Audio::alloc_channels(int64_t length, int32_t nb_channels, SampleFormat format) {
+    const size_t ssize = sample_size(format);
+    const size_t align_samples = AUDIO_ALIGNMENT / ssize;
+
+    guard = guard_length(rate, format);
+    const size_t stride = align_up(length, align_samples) + guard * 2;
+
+    free_channels();
+    all_data_size = stride * nb_channels * ssize;
+    uint8_t* buff = (uint8_t*) alloc_pages(all_data_size);
+    all_data = buff;
+    data = (void**) realloc(data, nb_channels * sizeof(void*));
+
+    for (int32_t j = 0; j < nb_channels; j++) {
+        data[j] = &buff[(stride * j + guard) * ssize];
     }
+}
 
-    // For each header block
-    char blkid[4];
-    while(1) {
-        if (fread(&blkid[0], 1, 4, file) != 4) {
-            return 5;
-        }
 
-        //printf("Chunk ID : %c%c%c%c\n", blkid[0], blkid[1], blkid[2], blkid[3]);
+void Audio::free_channels() {
+    free_pages(all_data, all_data_size);
+    all_data = nullptr;
+    all_data_size = 0;
+}
 
-        if (blkid[0] == 'J' && blkid[1] == 'U' && blkid[2] == 'N' && blkid[3] == 'K') {
-            if (fseek(file, 32, SEEK_CUR)) {
-                return 7;
-            }
-        }
 
-        else if (blkid[0] == 'f' && blkid[1] == 'm' && blkid[2] == 't' && blkid[3] == ' ') {
-            if (fread(&hdr_fmt, 1, sizeof(hdr_fmt), file) != sizeof(hdr_fmt)) {
-                return 8;
-            }
-        }
+void Audio::alloc_blocks() {
+    nb_blocks = (length + AUDIO_BLOCK_LEN - 1) / AUDIO_BLOCK_LEN;
+    blocks = new std::atomic<uint8_t>[nb_blocks];
+    blocks_used = new std::atomic<int64_t>[nb_blocks];
+    for (int64_t i = 0; i < nb_blocks; i++) {
+        blocks[i].store(BLOCK_EMPTY);
+        blocks_used[i].store(0);
+    }
+    use_clock = 0;
+    nb_resident = 0;
+    max_resident = AUDIO_LAZY_MAX_BLOCKS;
+}
 
-        else if (blkid[0] == 'd' && blkid[1] == 'a' && blkid[2] == 't' && blkid[3] == 'a') {
-            if (fread(&hdr_data, 1, 4, file) != 4) {
-                return 9;
-            }
-            hdr_data.data_size = ltohi(hdr_data.data_size);
-            hdr_data.data = malloc(hdr_data.data_size);
-            if (fread(hdr_data.data, 1, hdr_data.data_size, file) != hdr_data.data_size) {
-                return 10;
-            }
-            break;
+
+// Stop the reader thread and forget the mapped file and the blocks
+void Audio::close() {
+    if (stream) {
+        {
+            std::lock_guard<std::mutex> lock(blocks_mutex);
+            stream->stop = true;
         }
+        blocks_cond.notify_all();
+        stream->thread.join();
+        delete stream->flac;
+        fclose(stream->file);
+        free(stream->raw);
+        delete stream;
+        stream = nullptr;
+    }
 
-        else if (blkid[0] == 'L' && blkid[1] == 'I' && blkid[2] == 'S' && blkid[3] == 'T') {
-            uint32_t sub_chunk_size = 0;
-            if (fread(&sub_chunk_size, 1, 4, file) != 4) {
-                return 11;
-            }
-            sub_chunk_size = ltohi(sub_chunk_size);
-            if (fseek(file, sub_chunk_size, SEEK_CUR)) {
-                return 12;
+    if (decoder) {
+        delete decoder->reader;
+        fclose(decoder->file);
+        delete decoder;
+        decoder = nullptr;
+    }
+
+    unmap();
+
+    delete[] blocks;
+    blocks = nullptr;
+    delete[] blocks_used;
+    blocks_used = nullptr;
+    nb_blocks = 0;
+
+    free(mix_weights);
+    mix_weights = nullptr;
+
+    delete resampler;
+    resampler = nullptr;
+    resampled_from = nullptr;
+}
+
+
+// Convert a block from its interleaved samples
+void Audio::deinterleave_block(const uint8_t* raw, int64_t block) {
+    const int64_t start = block * AUDIO_BLOCK_LEN;
+    const int64_t count = min<int64_t>(AUDIO_BLOCK_LEN, length - start);
+    pcm_deinterleave(data, start, raw, count, source_nb_channels, source_format);
+}
+
+
+void Audio::release_block(int64_t block) {
+    const size_t ssize = sample_size(format);
+    const int64_t start = block * AUDIO_BLOCK_LEN;
+    const int64_t count = min<int64_t>(AUDIO_BLOCK_LEN, length - start);
+    for (int32_t j = 0; j < nb_channels; j++) {
+        release_pages((uint8_t*) data[j] + start * ssize, count * ssize);
+    }
+}
+
+
+// Release the least recently required blocks out of first to last (excluded) while too many are in memory
+// Must be called with blocks_mutex locked
+void Audio::evict_blocks(int64_t first, int64_t last) {
+    while (nb_resident > max_resident) {
+        int64_t victim = -1;
+        int64_t victim_used = INT64_MAX;
+        for (int64_t i = 0; i < nb_blocks; i++) {
+            if (i == first) i = last;
+            if (i >= nb_blocks) break;
+            const int64_t used = blocks_used[i].load(std::memory_order_relaxed);
+            if (used < victim_used && blocks[i].load(std::memory_order_relaxed) == BLOCK_READY) {
+                victim = i;
+                victim_used = used;
             }
         }
+        if (victim < 0) return;
+
+        blocks[victim].store(BLOCK_EMPTY);
+        release_block(victim);
+        nb_resident--;
 
-        else {
-            return 6;
+        // Pages of the mapped file are read again from the file if needed
+        if (source) {
+            const size_t frame_size = source_nb_channels * pcm_sample_size(source_format);
+            const int64_t start = victim * AUDIO_BLOCK_LEN;
+            release_pages((void*) &source[start * frame_size], min<int64_t>(AUDIO_BLOCK_LEN, length - start) * frame_size);
         }
     }
+}
+
+
+// Weighted sum of the channels written in place in the first one
+// The last vector can go past the end of the audio in the guards (they are zeroed so they stay zeroed)
+template<typename T>
+static void downmix(T* const* channels, const float* weights, int32_t nb_channels, int64_t start, int64_t count) {
+    T* out = channels[0];
+    for (int64_t i = start; i < start + count; i += SIMD_FLOAT_LEN) {
+        simd_float acc = simd_mul(simd_loadu(&out[i]), simd_set1(weights[0]));
+        for (int32_t j = 1; j < nb_channels; j++)
+            acc = simd_fmadd(simd_loadu(&channels[j][i]), simd_set1(weights[j]), acc);
+        simd_storeu(&out[i], acc);
+    }
+}
+
+
+// Downmix a range of frames and release the memory of the other channels in it
+void Audio::mix_range(int64_t start, int64_t count) {
+    const size_t ssize = sample_size(format);
+
+    if (format == SAMPLE_FMT_FLOAT32) {
+        downmix<float>((float* const*) data, mix_weights, source_nb_channels, start, count);
+    } else {
+        downmix<int16_t>((int16_t* const*) data, mix_weights, source_nb_channels, start, count);
+    }
+
+    for (int32_t j = 1; j < source_nb_channels; j++) {
+        release_pages((uint8_t*) data[j] + start * ssize, count * ssize);
+    }
+}
+
+
+void Audio::mix_block(int64_t block) {
+    const int64_t start = block * AUDIO_BLOCK_LEN;
+    mix_range(start, min<int64_t>(AUDIO_BLOCK_LEN, length - start));
+}
+
+
+void Audio::convert_to_monochannel(const float* weights) {
+    if (nb_channels <= 1) return;
+
+    float* w = (float*) malloc(nb_channels * sizeof(float));
+    for (int32_t j = 0; j < nb_channels; j++) {
+        w[j] = weights ? weights[j] : 1.f / nb_channels;
+    }
+
+    if (!blocks) {
+        mix_weights = w;
+        mix_range(0, length);
+        nb_channels = 1;
+        return;
+    }
+
+    // Blocks already converted are mixed now, the next ones are mixed when converted
+    std::lock_guard<std::mutex> lock(blocks_mutex);
+    mix_weights = w;
+    for (int64_t i = 0; i < nb_blocks; i++) {
+        if (blocks[i].load(std::memory_order_relaxed) == BLOCK_READY) mix_block(i);
+    }
+    nb_channels = 1;
+}
+
+
+int Audio::load_wav_file(std::string filename) {
+    wav_info_t info;
+    PcmFormat pcm;
+    int r;
+    FILE* file = open_wav_file(filename, &info, &pcm, &r);
+    if (file == NULL) {
+        return r;
+    }
+
+    void* raw_data = malloc(info.data_size);
+    if (fread(raw_data, 1, info.data_size, file) != (size_t) info.data_size) {
+        free(raw_data);
+        fclose(file);
+        return 10;
+    }
 
     fclose(file);
 
-    music->nb_channels = ltohs(hdr_fmt.nb_channels);
-    music->sample_width = ltohs(hdr_fmt.bits_per_sample);
-    music->nb_samples = (hdr_data.data_size * 8) / music->sample_width;
-    music->frequency = ltohi(hdr_fmt.frequency);
-    music->format = ltohs(hdr_fmt.audio_format);
-    music->data = hdr_data.data;
+    close();
 
-    printf("Data size : %i\n", hdr_data.data_size);
-    printf("Nb channels : %i\n", music->nb_channels);
-    printf("Sample width : %i\n", music->sample_width);
-    printf("Nb samples : %i\n", music->nb_samples);
-    printf("Frequency : %i\n", music->frequency);
+    rate = info.frequency;
+    decode_pcm((const uint8_t*) raw_data, info.data_size / info.block_align, info.nb_channels, pcm);
 
-    fflush(stdout);
+    free(raw_data);
 
     return 0;
 }
 
 
-bool Audio::load_wav_file(std::string filename) {
-    raw_music_t raw;
+// Convert all the interleaved samples of a file (the rate must be set)
+void Audio::decode_pcm(const uint8_t* raw, int64_t length, int32_t nb_channels, PcmFormat pcm) {
+    // int16 data stay int16 and are converted by the analysis kernels
+    format = pcm_storage_format(pcm);
+    alloc_channels(length, nb_channels, format);
+    pcm_deinterleave(data, 0, raw, length, nb_channels, pcm);
 
-    int r = load_raw_wav_file(filename.c_str(), &raw);
-    if (r) {
+    this->length = length;
+    this->nb_channels = nb_channels;
+    source_nb_channels = nb_channels;
+}
+
+
+int Audio::load_flac_file(std::string filename) {
+    flac_info_t info;
+    int r;
+    FILE* file = ::open_flac_file(filename, &info, &r);
+    if (file == NULL) {
         return r;
     }
 
-    uint8_t nbchnl = raw.nb_channels;
-    uint32_t length = raw.nb_samples / nbchnl;
+    uint8_t* raw_data = (uint8_t*) malloc(info.data_size);
+    if (fread(raw_data, 1, info.data_size, file) != (size_t) info.data_size) {
+        free(raw_data);
+        fclose(file);
+        return 10;
+    }
+
+    fclose(file);
+
+    close();
+
+    rate = info.frequency;
+    format = flac_storage_format(&info);
+    nb_channels = info.nb_channels;
+    source_nb_channels = nb_channels;
+    length = info.nb_samples;
+
+    alloc_channels(length, nb_channels, format);
+    r = flac_decode_all(raw_data, info.data_size, &info, data, format, &ThreadPool::shared());
+
+    free(raw_data);
+
+    return r;
+}
+
+
+// Open a file in memory to parse its header like files on disk
+static FILE* open_memory(const uint8_t* data, size_t size) {
+#ifdef _WIN32
+    FILE* file = tmpfile();
+    if (file == NULL) return NULL;
+    if (fwrite(data, 1, size, file) != size) {
+        fclose(file);
+        return NULL;
+    }
+    rewind(file);
+    return file;
+#else
+    return fmemopen((void*) data, size, "rb");
+#endif
+}
+
+
+int Audio::load_file_data(const uint8_t* file_data, size_t size) {
+    if (size == 0) return 10;
+
+    FILE* file = open_memory(file_data, size);
+    if (file == NULL) {
+        return 1;
+    }
+
+    int r;
+    if (size >= 4 && (memcmp(file_data, "fLaC", 4) == 0 || memcmp(file_data, "ID3", 3) == 0)) {
+        flac_info_t info;
+        r = flac_parse_header(file, &info);
+        fclose(file);
+        if (r) return r;
+        if (info.data_offset + info.data_size > (int64_t) size) return 10;
 
-    data = (float**) malloc(nbchnl * sizeof(float*));
-    float* out_data = (float*) malloc(length * nbchnl * sizeof(float));
-    all_data = out_data;
+        close();
 
-    for (uint32_t j = nbchnl; j--;)
-        data[j] = &out_data[length * j];
+        rate = info.frequency;
+        format = flac_storage_format(&info);
+        nb_channels = info.nb_channels;
+        source_nb_channels = nb_channels;
+        length = info.nb_samples;
 
-    if (raw.format == AUDIO_FMT_PCM_FLOAT) {
-        float* raw_data = (float*) raw.data;
-        if (raw.sample_width == 32) {
-            for (uint32_t i = 0; i < length; i++) {
-                for (uint32_t j = nbchnl; j--;)
-                    out_data[length * j + i] = raw_data[i * nbchnl + j];
+        alloc_channels(length, nb_channels, format);
+        return flac_decode_all(&file_data[info.data_offset], info.data_size, &info, data, format, &ThreadPool::shared());
+    }
+
+    wav_info_t info;
+    PcmFormat pcm;
+    r = wav_parse_header(file, &info);
+    if (r == 0) r = wav_pcm_format(&info, &pcm);
+    const int64_t data_offset = file_tell(file);
+    fclose(file);
+    if (r) return r;
+
+    // Truncated files are read up to their end
+    info.data_size = min<int64_t>(info.data_size, (int64_t) size - data_offset);
+
+    close();
+
+    rate = info.frequency;
+    decode_pcm(&file_data[data_offset], info.data_size / info.block_align, info.nb_channels, pcm);
+
+    return 0;
+}
+
+
+#ifdef _WIN32
+
+int Audio::map_wav_file(std::string filename) {
+    return load_wav_file(filename);
+}
+
+void Audio::unmap() {}
+
+#else
+
+int Audio::map_wav_file(std::string filename) {
+    wav_info_t info;
+    PcmFormat pcm;
+    int r;
+    FILE* file = open_wav_file(filename, &info, &pcm, &r);
+    if (file == NULL) {
+        return r;
+    }
+
+    close();
+
+    format = pcm_storage_format(pcm);
+    const size_t ssize = sample_size(format);
+
+    const int64_t data_size = info.data_size;
+    const size_t page = sysconf(_SC_PAGESIZE);
+
+    rate = info.frequency;
+    nb_channels = info.nb_channels;
+    source_nb_channels = nb_channels;
+    length = data_size / info.block_align;
+    guard = guard_length(rate, format);
+
+    // Reserve zeroed pages for the guards around the file pages and map the file between them
+    // Pages are private so the bytes of the other chunks sharing the first and last pages can be zeroed
+    const size_t guard_size = align_up(guard * ssize, page);
+    const size_t file_offset = info.data_offset / page * page;
+    const size_t head = info.data_offset - file_offset;
+    const size_t file_size = align_up(head + data_size, page);
+
+    mapping_size = guard_size + file_size + guard_size;
+    mapping = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        mapping = nullptr;
+        fclose(file);
+        return 14;
+    }
+
+    uint8_t* file_pages = (uint8_t*) mapping + guard_size;
+    if (mmap(file_pages, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fileno(file), file_offset) == MAP_FAILED) {
+        unmap();
+        fclose(file);
+        return 14;
+    }
+
+    fclose(file);
+
+    memset(file_pages, 0, head);
+    memset(&file_pages[head + data_size], 0, file_size - head - data_size);
+    madvise(file_pages, file_size, MADV_SEQUENTIAL);
+
+    const uint8_t* samples = &file_pages[head];
+
+    data = (void**) realloc(data, nb_channels * sizeof(void*));
+
+    // Mono samples are already planar, use them in place when they are stored as is
+    // (samples after an odd sized chunk are misaligned and converted like the other files)
+    if (nb_channels == 1 && (pcm == PCM_S16 || pcm == PCM_F32) && info.data_offset % ssize == 0) {
+        free_channels();
+        data[0] = (void*) samples;
+        return 0;
+    }
+
+    // Otherwise channels are deinterleaved block by block the first time they are required
+    alloc_channels(length, nb_channels, format);
+    source = samples;
+    source_format = pcm;
+    alloc_blocks();
+
+    return 0;
+}
+
+
+void Audio::unmap() {
+    if (mapping) munmap(mapping, mapping_size);
+    mapping = nullptr;
+    mapping_size = 0;
+    source = nullptr;
+}
+
+#endif
+
+
+int Audio::stream_wav_file(std::string filename) {
+    wav_info_t info;
+    PcmFormat pcm;
+    int r;
+    FILE* file = open_wav_file(filename, &info, &pcm, &r);
+    if (file == NULL) {
+        return r;
+    }
+
+    close();
+
+    rate = info.frequency;
+    format = pcm_storage_format(pcm);
+    source_format = pcm;
+    nb_channels = info.nb_channels;
+    source_nb_channels = nb_channels;
+    length = info.data_size / info.block_align;
+
+    // Channels are only reserved, memory is used by the blocks read
+    alloc_channels(length, nb_channels, format);
+    alloc_blocks();
+
+    stream = new AudioStream();
+    stream->file = file;
+    stream->data_offset = info.data_offset;
+    stream->file_pos = info.data_offset;
+    stream->block_align = info.block_align;
+    stream->raw = (uint8_t*) malloc((size_t) AUDIO_BLOCK_LEN * info.block_align);
+    stream->thread = std::thread(&Audio::stream_run, this);
+
+    return 0;
+}
+
+
+int Audio::stream_flac_file(std::string filename) {
+    flac_info_t info;
+    int r;
+    FILE* file = ::open_flac_file(filename, &info, &r);
+    if (file == NULL) {
+        return r;
+    }
+
+    close();
+
+    rate = info.frequency;
+    format = flac_storage_format(&info);
+    nb_channels = info.nb_channels;
+    source_nb_channels = nb_channels;
+    length = info.nb_samples;
+
+    alloc_channels(length, nb_channels, format);
+    alloc_blocks();
+
+    stream = new AudioStream();
+    stream->file = file;
+    stream->flac_info = info;
+    stream->flac = new FlacReader(file, &stream->flac_info);
+    stream->thread = std::thread(&Audio::stream_run, this);
+
+    return 0;
+}
+
+
+int Audio::open_flac_file(std::string filename) {
+    flac_info_t info;
+    int r;
+    FILE* file = ::open_flac_file(filename, &info, &r);
+    if (file == NULL) {
+        return r;
+    }
+
+    close();
+
+    rate = info.frequency;
+    format = flac_storage_format(&info);
+    nb_channels = info.nb_channels;
+    source_nb_channels = nb_channels;
+    length = info.nb_samples;
+
+    // Channels are only reserved, memory is used by the blocks decoded
+    alloc_channels(length, nb_channels, format);
+    alloc_blocks();
+
+    decoder = new AudioDecoder();
+    decoder->file = file;
+    decoder->info = info;
+    decoder->reader = new FlacReader(file, &decoder->info);
+
+    return 0;
+}
+
+
+int Audio::open_file(std::string filename) {
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (file == NULL) {
+        return 1;
+    }
+
+    char magic[4] = {0};
+    const size_t read = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+
+    if (read == sizeof(magic) && (memcmp(magic, "fLaC", 4) == 0 || memcmp(magic, "ID3", 3) == 0)) {
+        return open_flac_file(filename);
+    }
+    return map_wav_file(filename);
+}
+
+
+// First block from first to last (excluded) not read yet, -1 if none
+static int64_t first_missing(const std::atomic<uint8_t>* blocks, int64_t first, int64_t last) {
+    for (int64_t i = first; i < last; i++) {
+        if (blocks[i].load(std::memory_order_relaxed) != BLOCK_READY) return i;
+    }
+    return -1;
+}
+
+
+// Reader thread of streamed audios : read the required blocks then the ones after them,
+// releasing the blocks out of the required ranges when too many are in memory
+// The ranges are the ones of require() and of prefetch() (a second reader like a player)
+void Audio::stream_run() {
+    AudioStream* const s = stream;
+    std::unique_lock<std::mutex> lock(blocks_mutex);
+
+    while (!s->stop) {
+        const int64_t want_first = s->want_first;
+        const int64_t want_last = s->want_last;
+        const int64_t ahead_last = min<int64_t>(want_last + AUDIO_STREAM_AHEAD, nb_blocks);
+        const int64_t extra_first = s->extra_first;
+        const int64_t extra_last = s->extra_last;
+        const int64_t extra_ahead_last = extra_last > extra_first ? min<int64_t>(extra_last + AUDIO_STREAM_AHEAD, nb_blocks) : extra_last;
+
+        const auto is_required = [&](int64_t i) {
+            return (i >= want_first && i < want_last) || (i >= extra_first && i < extra_last);
+        };
+        const auto is_kept = [&](int64_t i) {
+            return (i >= want_first && i < ahead_last) || (i >= extra_first && i < extra_ahead_last);
+        };
+
+        // Required blocks of both readers first, then the read ahead
+        int64_t next = first_missing(blocks, want_first, want_last);
+        if (next < 0) next = first_missing(blocks, extra_first, extra_last);
+        if (next < 0) next = first_missing(blocks, want_last, ahead_last);
+        if (next < 0) next = first_missing(blocks, extra_last, extra_ahead_last);
+
+        if (next < 0) {
+            blocks_cond.wait(lock);
+            continue;
+        }
+
+        if (s->nb_resident >= AUDIO_STREAM_MAX_BLOCKS) {
+            // Release the block the farthest from the required ones
+            int64_t victim = -1;
+            for (int64_t i = 0; i < want_first && victim < 0; i++) {
+                if (!is_kept(i) && blocks[i].load(std::memory_order_relaxed) == BLOCK_READY) victim = i;
+            }
+            for (int64_t i = nb_blocks; i-- > ahead_last && victim < 0;) {
+                if (!is_kept(i) && blocks[i].load(std::memory_order_relaxed) == BLOCK_READY) victim = i;
+            }
+
+            if (victim >= 0) {
+                blocks[victim].store(BLOCK_EMPTY);
+                release_block(victim);
+                s->nb_resident--;
+            } else if (!is_required(next)) {
+                // Only read ahead blocks are missing, wait for room
+                blocks_cond.wait(lock);
+                continue;
             }
+        }
+
+        blocks[next].store(BLOCK_LOADING);
+        const bool mix = mix_weights != nullptr;
+        lock.unlock();
+
+        const int64_t start = next * AUDIO_BLOCK_LEN;
+        const int64_t count = min<int64_t>(AUDIO_BLOCK_LEN, length - start);
+
+        if (s->flac) {
+            // Samples of corrupted frames stay silent
+            s->flac->read(data, format, start, count);
         } else {
-            return 34;
+            const size_t size = count * s->block_align;
+            const int64_t pos = s->data_offset + start * s->block_align;
+
+            size_t read = 0;
+            if (pos == s->file_pos || file_seek(s->file, pos, SEEK_SET) == 0) {
+                read = fread(s->raw, 1, size, s->file);
+            }
+            s->file_pos = pos + read;
+
+            // Missing samples (read error) are silent
+            memset(&s->raw[read], 0, size - read);
+            deinterleave_block(s->raw, next);
+        }
+        if (mix) mix_block(next);
+
+        lock.lock();
+        // The audio was downmixed while the block was read
+        if (!mix && mix_weights) mix_block(next);
+        blocks[next].store(BLOCK_READY, std::memory_order_release);
+        s->nb_resident++;
+        blocks_cond.notify_all();
+    }
+}
+
+
+void Audio::require_blocks(int64_t start, int64_t end) {
+    const int64_t first = clamp<int64_t>(start, 0, length) / AUDIO_BLOCK_LEN;
+    const int64_t last = (clamp<int64_t>(end, 0, length) + AUDIO_BLOCK_LEN - 1) / AUDIO_BLOCK_LEN;
+
+    if (!stream) {
+        const int64_t used = ++use_clock;
+        for (int64_t i = first; i < last; i++) blocks_used[i].store(used, std::memory_order_relaxed);
+    }
+
+    if (resampled_from) {
+        require_resampled(first, last);
+        return;
+    }
+
+    // Move the read ahead of the stream
+    if (stream && (first != stream->want_first || last != stream->want_last)) {
+        {
+            std::lock_guard<std::mutex> lock(blocks_mutex);
+            stream->want_first = first;
+            stream->want_last = last;
         }
+        blocks_cond.notify_all();
     }
-    else if (raw.format == AUDIO_FMT_PCM_INT) {
-        int16_t* raw_data = (int16_t*) raw.data;
-        const float k = 1.f / 32767.f;
-        if (raw.sample_width == 16) {
-            for (uint32_t i = 0; i < length; i++) {
-                for (uint32_t j = nbchnl; j--;)
-                    out_data[length * j + i] = clamp((float) raw_data[i * nbchnl + j] * k, -1.f, 1.f);
+
+    for (int64_t i = first; i < last; i++) {
+        if (blocks[i].load(std::memory_order_acquire) == BLOCK_READY) continue;
+
+        std::unique_lock<std::mutex> lock(blocks_mutex);
+        if (stream) {
+            blocks_cond.wait(lock, [&]{ return blocks[i].load(std::memory_order_relaxed) == BLOCK_READY; });
+        } else if (blocks[i].load(std::memory_order_relaxed) != BLOCK_READY) {
+            if (source) {
+                deinterleave_block(&source[i * AUDIO_BLOCK_LEN * source_nb_channels * pcm_sample_size(source_format)], i);
+            } else {
+                // Samples of corrupted frames stay silent
+                const int64_t block_start = i * AUDIO_BLOCK_LEN;
+                decoder->reader->read(data, format, block_start, min<int64_t>(AUDIO_BLOCK_LEN, length - block_start));
             }
-        } else {
-            return 33;
+            if (mix_weights) mix_block(i);
+            blocks[i].store(BLOCK_READY, std::memory_order_release);
+            nb_resident++;
+            evict_blocks(first, last);
         }
     }
-    else {
-        return 32;
+}
+
+
+void Audio::prefetch(int64_t start, int64_t end) {
+    if (!blocks) return;
+    if (!stream) {
+        // Blocks converted when required are kept in least recently required order, both readers are fine
+        require_blocks(start, end);
+        return;
+    }
+
+    const int64_t first = clamp<int64_t>(start, 0, length) / AUDIO_BLOCK_LEN;
+    const int64_t last = (clamp<int64_t>(end, 0, length) + AUDIO_BLOCK_LEN - 1) / AUDIO_BLOCK_LEN;
+
+    if (first != stream->extra_first || last != stream->extra_last) {
+        {
+            std::lock_guard<std::mutex> lock(blocks_mutex);
+            stream->extra_first = first;
+            stream->extra_last = last;
+        }
+        blocks_cond.notify_all();
+    }
+
+    std::unique_lock<std::mutex> lock(blocks_mutex);
+    for (int64_t i = first; i < last; i++) {
+        blocks_cond.wait(lock, [&]{ return stream->stop || blocks[i].load(std::memory_order_relaxed) == BLOCK_READY; });
+    }
+}
+
+
+bool Audio::blocks_available(int64_t start, int64_t end) const {
+    const int64_t first = clamp<int64_t>(start, 0, length) / AUDIO_BLOCK_LEN;
+    const int64_t last = (clamp<int64_t>(end, 0, length) + AUDIO_BLOCK_LEN - 1) / AUDIO_BLOCK_LEN;
+    for (int64_t i = first; i < last; i++) {
+        if (blocks[i].load(std::memory_order_acquire) != BLOCK_READY) return false;
+    }
+    return true;
+}
+
+
+int Audio::resample(Audio* source, int32_t rate) {
+    if (rate <= 0 || source->rate <= 0) return 37;
+
+    Resampler* r = new Resampler();
+    r->init(source->rate, rate);
+
+    // Filters read the samples around the source in its guards
+    if (r->get_nb_taps() / 2 + 2 > source->guard) {
+        delete r;
+        return 37;
     }
 
-    free(raw.data);
+    close();
+
+    this->rate = rate;
+    format = source->format;
+    nb_channels = source->nb_channels;
+    source_nb_channels = nb_channels;
+    length = r->out_length(source->length);
+    alloc_channels(length, nb_channels, format);
+    resampler = r;
+
+    if (source->blocks) {
+        resampled_from = source;
+        alloc_blocks();
+        // The source doesn't keep all its samples, don't keep all the resampled ones either
+        if (source->stream) max_resident = AUDIO_STREAM_MAX_BLOCKS;
+        return 0;
+    }
+
+    for (int64_t i = 0; i * AUDIO_BLOCK_LEN < length; i++) {
+        resample_block(i, source);
+    }
 
-    length = length;
-    rate = raw.frequency;
-    nb_channels = raw.nb_channels;
+    delete resampler;
+    resampler = nullptr;
 
     return 0;
 }
+
+
+void Audio::resample_block(int64_t block, const Audio* source) {
+    const int64_t start = block * AUDIO_BLOCK_LEN;
+    const int64_t count = min<int64_t>(AUDIO_BLOCK_LEN, length - start);
+
+    for (int32_t j = 0; j < source_nb_channels; j++) {
+        if (format == SAMPLE_FMT_FLOAT32) {
+            resampler->process<float>((float*) data[j], source->get_data<float>(j), start, count);
+        } else {
+            resampler->process<int16_t>((int16_t*) data[j], source->get_data<int16_t>(j), start, count);
+        }
+    }
+
+    if (mix_weights) mix_block(block);
+}
+
+
+// Resample the missing blocks from the samples of the source, required first
+void Audio::require_resampled(int64_t first, int64_t last) {
+    int64_t missing = first;
+    while (missing < last && blocks[missing].load(std::memory_order_acquire) == BLOCK_READY) missing++;
+    if (missing == last) return;
+
+    resampled_from->require(resampler->in_start(missing * AUDIO_BLOCK_LEN), resampler->in_end(min<int64_t>(last * AUDIO_BLOCK_LEN, length)));
+
+    std::lock_guard<std::mutex> lock(blocks_mutex);
+    for (int64_t i = missing; i < last; i++) {
+        if (blocks[i].load(std::memory_order_relaxed) == BLOCK_READY) continue;
+        resample_block(i, resampled_from);
+        blocks[i].store(BLOCK_READY, std::memory_order_release);
+        nb_resident++;
+    }
+
+    evict_blocks(first, last);
+}
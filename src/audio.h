@@ -4,22 +4,190 @@
 
 
 #include <string>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+
+// Type of the samples stored by an audio
+enum SampleFormat {
+    SAMPLE_FMT_INT16,
+    SAMPLE_FMT_FLOAT32
+};
+
+
+// Informations on a sample type (format and scale to convert it to a float in [-1, 1])
+template<typename T>
+struct SampleType;
+
+template<>
+struct SampleType<int16_t> {
+    static constexpr SampleFormat format = SAMPLE_FMT_INT16;
+    static constexpr float scale = 1.f / 32767.f;
+};
+
+template<>
+struct SampleType<float> {
+    static constexpr SampleFormat format = SAMPLE_FMT_FLOAT32;
+    static constexpr float scale = 1.f;
+};
+
+template<typename T>
+inline float sample_to_float(const T v) {
+    return (float) v * SampleType<T>::scale;
+}
+
+
+#define AUDIO_ALIGNMENT 64 // Alignment in bytes of each channel data
+#define AUDIO_GUARD_MIN_FREQ (13.f) // Lowest frequency which one period must fit inside the guards
+#define AUDIO_BLOCK_LEN (1 << 16) // Number of frames converted at once by lazy loaded audios
+#define AUDIO_STREAM_AHEAD 2 // Number of blocks read ahead of the last required one by streamed audios
+#define AUDIO_STREAM_MAX_BLOCKS 16 // Maximum number of blocks in memory for streamed audios
+#define AUDIO_LAZY_MAX_BLOCKS 64 // Maximum number of blocks in memory for audios converted when required (least recently required ones are released)
+
+
+enum BlockState : uint8_t {
+    BLOCK_EMPTY,
+    BLOCK_LOADING,
+    BLOCK_READY
+};
+
+
+struct AudioStream;
+struct AudioDecoder;
+enum PcmFormat : uint8_t;
+class Resampler;
 
 
 class Audio {
 private:
-    float** data; // Per channel data
-    float* all_data;
+    void** data; // Per channel data
+    void* all_data;
+    size_t all_data_size;
+
+    // Memory mapped file (nullptr if the audio was fully loaded)
+    void* mapping;
+    size_t mapping_size;
+
+    // Interleaved samples of the mapped file still to convert (nullptr if nothing to convert)
+    const uint8_t* source;
+    PcmFormat source_format; // Format of the samples in the file (mapped or streamed)
+    int32_t source_nb_channels; // Number of channels in the file (nb_channels is 1 once downmixed)
+
+    // Weight of each source channel once downmixed (nullptr if the channels are kept)
+    float* mix_weights;
+
+    // Blocks of lazy loaded audios (mapped, decoded when required or streamed)
+    std::atomic<uint8_t>* blocks;
+    int64_t nb_blocks;
+    std::mutex blocks_mutex;
+    std::condition_variable blocks_cond;
+
+    // Blocks converted when required (not streamed) are released in least recently required order
+    std::atomic<int64_t>* blocks_used; // Last call to require() including each block
+    std::atomic<int64_t> use_clock;
+    int64_t nb_resident;
+    int64_t max_resident;
+
+    // Reader thread of streamed audios
+    AudioStream* stream;
+
+    // Decoder of compressed audios decoded when required
+    AudioDecoder* decoder;
+
+    // Lazy loaded audio this one is resampled from (nullptr if it was loaded from a file or fully resampled)
+    Audio* resampled_from;
+    Resampler* resampler;
+
+    void alloc_channels(int64_t length, int32_t nb_channels, SampleFormat format);
+    void free_channels();
+    void alloc_blocks();
+    void decode_pcm(const uint8_t* raw, int64_t length, int32_t nb_channels, PcmFormat pcm);
+    void deinterleave_block(const uint8_t* raw, int64_t block);
+    void release_block(int64_t block);
+    void evict_blocks(int64_t first, int64_t last);
+    void mix_range(int64_t start, int64_t count);
+    void mix_block(int64_t block);
+    void resample_block(int64_t block, const Audio* source);
+    void require_resampled(int64_t first, int64_t last);
+    void unmap();
+    void close();
+    void stream_run();
 
 public:
     int64_t length;
     int32_t rate;
     int32_t nb_channels;
+    SampleFormat format; // Samples are kept as int16 up to 16 bits files (no float copy) and as float above
+    int64_t guard; // Number of zeroed samples before and after each channel (at least one period at AUDIO_GUARD_MIN_FREQ)
+
+    Audio();
+    ~Audio();
+
+    // Read and convert the whole file, return 0 on success or an error code
+    int load_wav_file(std::string filename);
+
+    // Map the file in memory without reading it, mono files are used in place
+    // and other files are deinterleaved block by block when required
+    // Return 0 on success or an error code
+    int map_wav_file(std::string filename);
+
+    // Read the file block by block on a background thread, keeping at most AUDIO_STREAM_MAX_BLOCKS in memory
+    // Blocks are read ahead of the last required ones, meant for one mostly sequential reader
+    // Return 0 on success or an error code
+    int stream_wav_file(std::string filename);
+
+    // Decode a whole FLAC file, its frames are decoded in parallel
+    // Return 0 on success or an error code
+    int load_flac_file(std::string filename);
+
+    // Decode a FLAC file block by block on a background thread like stream_wav_file()
+    // Return 0 on success or an error code
+    int stream_flac_file(std::string filename);
+
+    // Open a FLAC file without decoding it, blocks are decoded when required
+    // Return 0 on success or an error code
+    int open_flac_file(std::string filename);
+
+    // Open a WAV or FLAC file (found from its content) in the cheapest way : nothing is read or decoded
+    // before being required so the time to reach any position doesn't depend on the length of the file
+    // Return 0 on success or an error code
+    int open_file(std::string filename);
+
+    // Decode a whole WAV or FLAC file already read in memory (it isn't used once this returns)
+    // Nothing is printed so many files can be loaded at once
+    // Return 0 on success or an error code
+    int load_file_data(const uint8_t* file_data, size_t size);
+
+    // Resample another audio at a new rate (the analysis is then independent of the rate of the files)
+    // Fully loaded sources are resampled at once, lazy loaded ones block by block when required
+    // and must stay alive and unchanged while this audio is used (blocks of streamed sources are released like theirs)
+    // Return 0 on success or an error code
+    int resample(Audio* source, int32_t rate);
+
+    // Make sure samples from start to end (excluded) are available in get_data()
+    // Wait for the reader thread if the audio is streamed and the samples are not read yet
+    // Samples of lazy loaded audios stay available until enough other blocks are required (see AUDIO_*_MAX_BLOCKS)
+    inline void require(int64_t start, int64_t end) { if (blocks) require_blocks(start, end); }
+    void require_blocks(int64_t start, int64_t end);
+
+    // Like require() for a second reader besides the one calling require() (like a player next to the analysis) :
+    // streamed audios read ahead of both ranges and keep them instead of moving from one to the other
+    void prefetch(int64_t start, int64_t end);
 
-    bool load_wav_file(std::string filename);
+    // Whether samples from start to end (excluded) are available in get_data(), nothing is waited for nor loaded
+    // (real-time threads check this instead of calling require(), samples of blocks released meanwhile read as zeros)
+    inline bool available(int64_t start, int64_t end) const { return !blocks || blocks_available(start, end); }
+    bool blocks_available(int64_t start, int64_t end) const;
 
-    // Do the mean of all channel and put the result on the first channel
-    void convert_to_monochannel();
+    // Mix all channels in place in the first one and give back the memory of the others
+    // weights has one entry per channel, nullptr for the mean of the channels
+    // Blocks of lazy loaded audios not converted yet are mixed as soon as they are
+    void convert_to_monochannel(const float* weights = nullptr);
 
-    inline const float* get_data(int channel) { return data[channel]; }
+    // Data of a channel, T must match the format of the audio
+    // Aligned on AUDIO_ALIGNMENT (except for mapped mono files) and readable from -guard to length + guard
+    template<typename T>
+    inline const T* get_data(int channel) const { return (const T*) data[channel]; }
 };
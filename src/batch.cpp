@@ -0,0 +1,618 @@
+#include "batch.h"
+
+#include "audio.h"
+#include "extractor.h"
+#include "interpretor.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include <algorithm>
+#include <cctype>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+
+// File read in memory
+struct BatchFile {
+    int64_t index = 0;
+    int error = 0;
+    uint8_t* data = nullptr;
+    size_t size = 0;
+    uint64_t read_start = 0;
+    uint64_t read_end = 0;
+
+    // Reads with io_uring
+    int fd = -1;
+    size_t submitted = 0; // Bytes with a read submitted
+    size_t done = 0; // Bytes read
+    int32_t nb_pending = 0; // Reads in flight
+
+    ~BatchFile() { free(data); }
+};
+
+
+// Read the files of a batch ahead of their analysis, at most max_ahead files are read and not taken yet
+class BatchReader {
+private:
+    const std::vector<std::string>* files;
+    int64_t max_ahead;
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable ready_cond; // A file is read
+    std::condition_variable space_cond; // A file was taken
+    std::deque<BatchFile*> ready;
+    int64_t next_file; // Next file to read
+    int64_t nb_ahead; // Files read or being read, not taken yet
+    int64_t nb_taken;
+    bool stop;
+    bool uring;
+
+    int64_t next_index(bool wait);
+    void finish(BatchFile* file);
+    void run_threads();
+    bool run_uring();
+
+public:
+    BatchReader(const std::vector<std::string>* files, int64_t max_ahead);
+    ~BatchReader();
+
+    // Wait for the next file read (files are taken in the order their reads end), nullptr once they are all taken
+    BatchFile* take();
+
+    inline bool uses_uring() const { return uring; }
+};
+
+
+#ifdef __linux__
+
+// Minimal io_uring (without liburing) keeping many reads in flight from a single thread
+struct IoUring {
+    int fd = -1;
+    uint8_t* sq_ring = (uint8_t*) MAP_FAILED;
+    uint8_t* cq_ring = (uint8_t*) MAP_FAILED;
+    io_uring_sqe* sqes = (io_uring_sqe*) MAP_FAILED;
+    size_t sq_ring_size = 0;
+    size_t cq_ring_size = 0;
+    size_t sqes_size = 0;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_array;
+    unsigned sq_mask;
+    unsigned nb_entries;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    io_uring_cqe* cqes;
+    unsigned cq_mask;
+
+    unsigned to_submit = 0;
+};
+
+
+static void uring_close(IoUring* ring) {
+    if (ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+    if (ring->fd >= 0) close(ring->fd);
+    ring->fd = -1;
+}
+
+
+// Return false if io_uring isn't available (old kernel, disabled or forbidden)
+static bool uring_init(IoUring* ring, unsigned entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) return false;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        ring->sq_ring_size = ring->cq_ring_size = max(ring->sq_ring_size, ring->cq_ring_size);
+    }
+
+    ring->sq_ring = (uint8_t*) mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        uring_close(ring);
+        return false;
+    }
+
+    ring->cq_ring = single_mmap ? ring->sq_ring :
+        (uint8_t*) mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    ring->sqes = (io_uring_sqe*) mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        uring_close(ring);
+        return false;
+    }
+
+    ring->sq_head = (unsigned*) &ring->sq_ring[params.sq_off.head];
+    ring->sq_tail = (unsigned*) &ring->sq_ring[params.sq_off.tail];
+    ring->sq_array = (unsigned*) &ring->sq_ring[params.sq_off.array];
+    ring->sq_mask = *(unsigned*) &ring->sq_ring[params.sq_off.ring_mask];
+    ring->nb_entries = params.sq_entries;
+    ring->cq_head = (unsigned*) &ring->cq_ring[params.cq_off.head];
+    ring->cq_tail = (unsigned*) &ring->cq_ring[params.cq_off.tail];
+    ring->cqes = (io_uring_cqe*) &ring->cq_ring[params.cq_off.cqes];
+    ring->cq_mask = *(unsigned*) &ring->cq_ring[params.cq_off.ring_mask];
+
+    return true;
+}
+
+
+// Queue a read, it is submitted by the next uring_enter()
+static bool uring_read(IoUring* ring, int fd, const iovec* iov, size_t offset, uint64_t user_data) {
+    const unsigned tail = *ring->sq_tail;
+    if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->nb_entries) return false;
+
+    const unsigned index = tail & ring->sq_mask;
+    io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->addr = (uint64_t) (uintptr_t) iov;
+    sqe->len = 1;
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+    return true;
+}
+
+
+// Submit the queued reads and wait for at least one of them to end
+// Return false if the ring can't be used anymore
+static bool uring_enter(IoUring* ring) {
+    while (true) {
+        const int r = (int) syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (r >= 0) {
+            ring->to_submit -= r;
+            return true;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) return false;
+    }
+}
+
+
+// Call fn(user_data, res) for each ended read
+template<typename F>
+static void uring_reap(IoUring* ring, F fn) {
+    unsigned head = *ring->cq_head;
+    const unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        const io_uring_cqe* cqe = &ring->cqes[head & ring->cq_mask];
+        fn(cqe->user_data, cqe->res);
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+#endif
+
+
+BatchReader::BatchReader(const std::vector<std::string>* files, int64_t max_ahead) {
+    this->files = files;
+    this->max_ahead = max<int64_t>(max_ahead, 1);
+    next_file = 0;
+    nb_ahead = 0;
+    nb_taken = 0;
+    stop = false;
+    uring = false;
+
+#ifdef __linux__
+    // Check io_uring is allowed before relying on it
+    IoUring ring;
+    uring = uring_init(&ring, 1);
+    uring_close(&ring);
+#endif
+
+    if (uring) {
+        // Reads end in the same thread as the files left if the ring fails
+        threads.emplace_back([this]{ if (!run_uring()) run_threads(); });
+    } else {
+        for (int32_t i = 0; i < BATCH_READ_THREADS; i++) {
+            threads.emplace_back(&BatchReader::run_threads, this);
+        }
+    }
+}
+
+
+BatchReader::~BatchReader() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    space_cond.notify_all();
+    for (std::thread& thread : threads) thread.join();
+
+    for (BatchFile* file : ready) delete file;
+}
+
+
+// Index of the next file to read, -1 if there is none left or (if wait is false) the read ahead is full
+int64_t BatchReader::next_index(bool wait) {
+    std::unique_lock<std::mutex> lock(mutex);
+    const int64_t nb_files = (int64_t) files->size();
+    if (wait) {
+        space_cond.wait(lock, [&]{ return stop || next_file >= nb_files || nb_ahead < max_ahead; });
+    }
+    if (stop || next_file >= nb_files || nb_ahead >= max_ahead) return -1;
+
+    nb_ahead++;
+    return next_file++;
+}
+
+
+void BatchReader::finish(BatchFile* file) {
+    file->read_end = micros();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ready.push_back(file);
+    }
+    ready_cond.notify_one();
+}
+
+
+BatchFile* BatchReader::take() {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (nb_taken >= (int64_t) files->size()) return nullptr;
+    ready_cond.wait(lock, [&]{ return !ready.empty(); });
+
+    BatchFile* file = ready.front();
+    ready.pop_front();
+    nb_ahead--;
+    nb_taken++;
+    lock.unlock();
+
+    space_cond.notify_all();
+    return file;
+}
+
+
+// Read whole files with blocking reads
+void BatchReader::run_threads() {
+    int64_t index;
+    while ((index = next_index(true)) >= 0) {
+        BatchFile* file = new BatchFile();
+        file->index = index;
+        file->read_start = micros();
+
+        FILE* f = fopen((*files)[index].c_str(), "rb");
+        int64_t size = -1;
+        if (f == NULL) {
+            file->error = 1;
+        } else if (file_seek(f, 0, SEEK_END) == 0 && (size = file_tell(f)) >= 0 && file_seek(f, 0, SEEK_SET) == 0) {
+            file->size = size;
+            file->data = (uint8_t*) malloc(max<size_t>(file->size, 1));
+            if (fread(file->data, 1, file->size, f) != file->size) file->error = 10;
+        } else {
+            file->error = 13;
+        }
+        if (f) fclose(f);
+
+        finish(file);
+    }
+}
+
+
+// Read the files with io_uring, reads of all the files read ahead are in flight at once
+// Return false if io_uring failed (the files being read are then reported as not read)
+bool BatchReader::run_uring() {
+#ifdef __linux__
+    IoUring ring;
+    if (!uring_init(&ring, BATCH_URING_ENTRIES)) return false;
+
+    struct Request {
+        BatchFile* file;
+        size_t offset;
+        iovec iov;
+    };
+    std::vector<Request> requests(ring.nb_entries);
+    std::vector<uint32_t> free_requests;
+    for (uint32_t i = 0; i < ring.nb_entries; i++) free_requests.push_back(i);
+    std::vector<uint32_t> retries; // Requests with a short read to read again
+    std::vector<BatchFile*> reading;
+    bool ok = true;
+
+    // Files are done once all their reads ended (or one failed and the others ended)
+    auto end_read = [&](BatchFile* file) {
+        file->nb_pending--;
+        if (file->nb_pending == 0 && (file->error || file->done == file->size)) {
+            close(file->fd);
+            reading.erase(std::find(reading.begin(), reading.end(), file));
+            finish(file);
+        }
+    };
+
+    while (ok) {
+        // Open the next files while the read ahead isn't full, wait for space if nothing is being read
+        int64_t index;
+        while ((index = next_index(reading.empty())) >= 0) {
+            BatchFile* file = new BatchFile();
+            file->index = index;
+            file->read_start = micros();
+
+            struct stat st;
+            file->fd = open((*files)[index].c_str(), O_RDONLY | O_CLOEXEC);
+            if (file->fd < 0) {
+                file->error = 1;
+            } else if (fstat(file->fd, &st) != 0) {
+                file->error = 13;
+            } else {
+                file->size = st.st_size;
+                file->data = (uint8_t*) malloc(max<size_t>(file->size, 1));
+            }
+
+            if (file->error || file->size == 0) {
+                if (file->fd >= 0) close(file->fd);
+                finish(file);
+            } else {
+                reading.push_back(file);
+            }
+        }
+        if (reading.empty()) break;
+
+        // Queue the reads while there are free requests
+        for (size_t i = 0; i < retries.size();) {
+            Request* q = &requests[retries[i]];
+            if (!uring_read(&ring, q->file->fd, &q->iov, q->offset, retries[i])) break;
+            retries.erase(retries.begin() + i);
+        }
+        for (BatchFile* file : reading) {
+            while (!file->error && file->submitted < file->size && !free_requests.empty()) {
+                const uint32_t id = free_requests.back();
+                Request* q = &requests[id];
+                q->file = file;
+                q->offset = file->submitted;
+                q->iov.iov_base = &file->data[q->offset];
+                q->iov.iov_len = min<size_t>(BATCH_READ_SIZE, file->size - q->offset);
+                if (!uring_read(&ring, file->fd, &q->iov, q->offset, id)) break;
+
+                free_requests.pop_back();
+                file->submitted += q->iov.iov_len;
+                file->nb_pending++;
+            }
+        }
+
+        if (!uring_enter(&ring)) {
+            ok = false;
+            break;
+        }
+
+        uring_reap(&ring, [&](uint64_t id, int32_t res) {
+            Request* q = &requests[id];
+            BatchFile* file = q->file;
+            if (res > 0 && (size_t) res < q->iov.iov_len && !file->error) {
+                // Short read, read the rest
+                file->done += res;
+                q->offset += res;
+                q->iov.iov_base = &file->data[q->offset];
+                q->iov.iov_len -= res;
+                retries.push_back((uint32_t) id);
+                return;
+            }
+
+            if (res < 0) file->error = 10;
+            else if (res == 0) file->error = 10; // The file got shorter
+            else file->done += res;
+
+            free_requests.push_back((uint32_t) id);
+            end_read(file);
+        });
+    }
+
+    uring_close(&ring);
+
+    // The ring stopped working, the reads in flight are cancelled with it
+    for (BatchFile* file : reading) {
+        file->error = 10;
+        close(file->fd);
+        finish(file);
+    }
+
+    return ok;
+#else
+    return false;
+#endif
+}
+
+
+int batch_list_files(std::string path, std::vector<std::string>* files) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+
+    files->clear();
+
+    if (fs::is_directory(path, ec)) {
+        for (const fs::directory_entry& entry : fs::directory_iterator(path, ec)) {
+            std::string ext = entry.path().extension().string();
+            std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c){ return std::tolower(c); });
+            if (entry.is_regular_file(ec) && (ext == ".wav" || ext == ".flac" || ext == ".rf64" || ext == ".w64")) {
+                files->push_back(entry.path().string());
+            }
+        }
+        if (ec) return 1;
+        std::sort(files->begin(), files->end());
+        return 0;
+    }
+
+    std::ifstream list(path);
+    if (!list) return 1;
+
+    std::string line;
+    while (std::getline(list, line)) {
+        while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        files->push_back(line);
+    }
+
+    return 0;
+}
+
+
+// Decode and analyze a file read in memory
+static void transcribe(BatchFile* file, const std::string& filename, const batch_config_t* config, batch_result_t* result) {
+    result->filename = filename;
+    result->error = file->error;
+    result->read_time = file->read_end - file->read_start;
+    if (file->error) return;
+
+    const uint64_t decode_start = micros();
+
+    Audio audio;
+    Audio analysis_audio;
+    int r = audio.load_file_data(file->data, file->size);
+
+    // The file isn't needed anymore, keep the memory for the files read ahead
+    free(file->data);
+    file->data = nullptr;
+
+    if (r == 0) {
+        audio.convert_to_monochannel();
+        r = analysis_audio.resample(&audio, config->analysis_rate);
+    }
+
+    const uint64_t analysis_start = micros();
+    result->decode_time = analysis_start - decode_start;
+    if (r) {
+        result->error = r;
+        return;
+    }
+
+    FILE* out = NULL;
+    if (!config->output_dir.empty()) {
+        const std::filesystem::path out_path = std::filesystem::path(config->output_dir) / std::filesystem::path(filename).filename().concat(".txt");
+        out = fopen(out_path.string().c_str(), "w");
+        if (out == NULL) {
+            result->error = 1;
+            return;
+        }
+    }
+
+    Extractor extractor;
+    Interpretor interpretor;
+    extractor.set_audio(&analysis_audio);
+    extractor.set_window_width(1.f / (float) config->nps);
+    extractor.set_freq_domain(20, 5000);
+    interpretor.set_extractor(&extractor);
+
+    // Histograms of all the frames, then their notes interpreted at once
+    result->duration = (double) analysis_audio.length / analysis_audio.rate;
+    result->nb_frames = (int64_t) ceil(result->duration * config->fps);
+    const size_t nb_frames = (size_t) result->nb_frames;
+    const size_t nb_entries = extractor.histogram.nb_entries;
+    std::vector<float> strengths(nb_frames * nb_entries);
+    for (size_t f = 0; f < nb_frames; f++) {
+        for (size_t i = 0; i < nb_entries; i++) strengths[f * nb_entries + i] = extractor.histogram.entries[i].value;
+        extractor.forward(1. / config->fps);
+    }
+
+    std::vector<Note> notes(nb_frames * config->nb_notes);
+    std::vector<size_t> nb_notes(nb_frames);
+    interpretor.extract_notes_batch(strengths.data(), nb_frames, STAGE_HUMAN_HEAR, notes.data(), nb_notes.data(), config->nb_notes);
+
+    // One line per frame : time then frequency and strength of each note
+    if (out) {
+        for (size_t f = 0; f < nb_frames; f++) {
+            const Note* frame_notes = &notes[f * config->nb_notes];
+            fprintf(out, "%.3f", (double) f / config->fps);
+            for (size_t i = 0; i < nb_notes[f]; i++) fprintf(out, " %.2f:%.4f", frame_notes[i].freq, frame_notes[i].strength);
+            fprintf(out, "\n");
+        }
+        fclose(out);
+    }
+
+    result->analysis_time = micros() - analysis_start;
+}
+
+
+int batch_run(const std::vector<std::string>& files, const batch_config_t* config, std::vector<batch_result_t>* results) {
+    ThreadPool& pool = ThreadPool::shared();
+    const int64_t nb_files = (int64_t) files.size();
+
+    std::vector<batch_result_t> all_results(nb_files);
+    std::mutex print_mutex;
+
+    if (!config->output_dir.empty()) {
+        std::error_code ec;
+        std::filesystem::create_directories(config->output_dir, ec);
+    }
+
+    BatchReader reader(&files, pool.get_nb_threads() * BATCH_PREFETCH_PER_THREAD);
+    printf("Transcribing %" PRId64 " files on %i threads (reads with %s)\n", nb_files, pool.get_nb_threads(), reader.uses_uring() ? "io_uring" : "threads");
+
+    const uint64_t start = micros();
+
+    // Each iteration takes whichever file is read first, other files are read meanwhile
+    pool.parallel_for(nb_files, [&](int64_t) {
+        BatchFile* file = reader.take();
+        if (!file) return;
+
+        batch_result_t* result = &all_results[file->index];
+        transcribe(file, files[file->index], config, result);
+        result->latency = micros() - file->read_start;
+        delete file;
+
+        std::lock_guard<std::mutex> lock(print_mutex);
+        if (result->error) {
+            printf("%s : error %i\n", result->filename.c_str(), result->error);
+        } else {
+            printf("%s : %.1fs, %.1fms (read %.1fms, decode %.1fms, analysis %.1fms)\n", result->filename.c_str(), result->duration,
+                result->latency / 1e3, result->read_time / 1e3, result->decode_time / 1e3, result->analysis_time / 1e3);
+        }
+    });
+
+    const double elapsed = (micros() - start) / 1e6;
+
+    // Summary over the files transcribed
+    int nb_failed = 0;
+    double audio_duration = 0.;
+    std::vector<uint64_t> latencies;
+    uint64_t read_time = 0, decode_time = 0, analysis_time = 0;
+    for (const batch_result_t& result : all_results) {
+        if (result.error) {
+            nb_failed++;
+            continue;
+        }
+        audio_duration += result.duration;
+        latencies.push_back(result.latency);
+        read_time += result.read_time;
+        decode_time += result.decode_time;
+        analysis_time += result.analysis_time;
+    }
+
+    printf("\n%" PRId64 " files (%i failed) in %.2fs : %.2f files/s, %.1fx real time\n", nb_files, nb_failed, elapsed,
+        nb_files / max(elapsed, 1e-9), audio_duration / max(elapsed, 1e-9));
+
+    if (!latencies.empty()) {
+        const size_t n = latencies.size();
+        std::sort(latencies.begin(), latencies.end());
+        printf("Latency : p50 %.1fms, p95 %.1fms, max %.1fms\n", latencies[n / 2] / 1e3, latencies[min(n * 95 / 100, n - 1)] / 1e3, latencies[n - 1] / 1e3);
+        printf("Mean per file : read %.1fms, decode %.1fms, analysis %.1fms\n", read_time / 1e3 / n, decode_time / 1e3 / n, analysis_time / 1e3 / n);
+    }
+
+    if (results) *results = std::move(all_results);
+
+    return nb_failed;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+// Transcribe many files at once : the next files are read asynchronously while the previous ones are analyzed
+
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+#define BATCH_PREFETCH_PER_THREAD 2 // Files read ahead of the analysis for each thread of the pool
+#define BATCH_READ_SIZE (1 << 20) // Size of each read request
+#define BATCH_URING_ENTRIES 64 // Maximum number of reads in flight with io_uring
+#define BATCH_READ_THREADS 4 // Threads reading the files when io_uring isn't available
+
+
+typedef struct {
+    int32_t nb_notes; // Maximum number of simultaneous notes
+    int32_t nps; // Notes per seconds
+    int32_t fps; // Frames analyzed per seconds
+    int32_t analysis_rate; // Rate the files are resampled at
+    std::string output_dir; // The notes of each file are written in <name of the file>.txt in this directory (nothing is written if empty)
+} batch_config_t;
+
+
+typedef struct {
+    std::string filename;
+    int error; // 0 or the error code of the file
+    double duration; // Of the audio in seconds
+    int64_t nb_frames;
+    uint64_t read_time; // In microseconds
+    uint64_t decode_time;
+    uint64_t analysis_time;
+    uint64_t latency; // From the begining of the read to the end of the analysis
+} batch_result_t;
+
+
+// List the WAV and FLAC files of a directory (sorted) or the files of a list (one path per line)
+// Return 0 on success or an error code
+int batch_list_files(std::string path, std::vector<std::string>* files);
+
+// Transcribe the files on the shared thread pool, print the latency of each one and the throughput
+// The output directory is created if needed, results receives the result of each file in the order of the list (ignored if nullptr)
+// Return the number of files that couldn't be transcribed
+int batch_run(const std::vector<std::string>& files, const batch_config_t* config, std::vector<batch_result_t>* results);
@@ -0,0 +1,412 @@
+#include "convert.h"
+
+#include "utils.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CONVERT_X86
+#endif
+
+
+#define CONVERT_CHUNK 4096 // Number of samples converted at once before being deinterleaved (stay in L1 cache)
+
+
+constexpr float S24_SCALE = 1.f / 8388607.f;
+constexpr float S32_SCALE = 1.f / 2147483647.f;
+
+
+// Kernels convert contiguous samples (whatever the channel they belong to), deinterleave stereo samples
+// or deinterleave more channels (sample i of channel j is written at out[j][start + i])
+struct PcmKernels {
+    const char* name;
+    void (*u8_to_s16)(int16_t* out, const uint8_t* in, size_t n);
+    void (*s24_to_f32)(float* out, const uint8_t* in, size_t n);
+    void (*s32_to_f32)(float* out, const uint8_t* in, size_t n);
+    void (*f64_to_f32)(float* out, const uint8_t* in, size_t n);
+    void (*deinterleave2_s16)(int16_t* left, int16_t* right, const uint8_t* in, size_t n);
+    void (*deinterleave2_f32)(float* left, float* right, const uint8_t* in, size_t n);
+    void (*deinterleaven_s16)(int16_t** out, int64_t start, const uint8_t* in, size_t n, int32_t nb_channels);
+    void (*deinterleaven_f32)(float** out, int64_t start, const uint8_t* in, size_t n, int32_t nb_channels);
+};
+
+
+template<typename T>
+static inline T load(const uint8_t* p) {
+    T v;
+    memcpy(&v, p, sizeof(T));
+    return v;
+}
+
+
+// Scalar kernels (also used for the end of the vectorized ones)
+
+static void u8_to_s16_scalar(int16_t* out, const uint8_t* in, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        out[i] = (int16_t) (((int32_t) in[i] - 128) * 256);
+}
+
+static void s24_to_f32_scalar(float* out, const uint8_t* in, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        const uint32_t v = ((uint32_t) in[i * 3] << 8) | ((uint32_t) in[i * 3 + 1] << 16) | ((uint32_t) in[i * 3 + 2] << 24);
+        out[i] = (float) ((int32_t) v >> 8) * S24_SCALE;
+    }
+}
+
+static void s32_to_f32_scalar(float* out, const uint8_t* in, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        out[i] = (float) load<int32_t>(&in[i * 4]) * S32_SCALE;
+}
+
+static void f64_to_f32_scalar(float* out, const uint8_t* in, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        out[i] = (float) load<double>(&in[i * 8]);
+}
+
+template<typename T>
+static void deinterleave2_scalar(T* left, T* right, const uint8_t* in, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        left[i]  = load<T>(&in[i * 2 * sizeof(T)]);
+        right[i] = load<T>(&in[(i * 2 + 1) * sizeof(T)]);
+    }
+}
+
+template<typename T>
+static void deinterleaven_scalar(T** out, int64_t start, const uint8_t* in, size_t n, int32_t nb_channels) {
+    for (size_t i = 0; i < n; i++) {
+        for (int32_t j = 0; j < nb_channels; j++)
+            out[j][start + i] = load<T>(&in[(i * nb_channels + j) * sizeof(T)]);
+    }
+}
+
+static const PcmKernels SCALAR_KERNELS = {
+    "scalar",
+    u8_to_s16_scalar,
+    s24_to_f32_scalar,
+    s32_to_f32_scalar,
+    f64_to_f32_scalar,
+    deinterleave2_scalar<int16_t>,
+    deinterleave2_scalar<float>,
+    deinterleaven_scalar<int16_t>,
+    deinterleaven_scalar<float>
+};
+
+
+#ifdef CONVERT_X86
+
+// SSE2 kernels (no byte shuffle in SSE2 so 24 bits samples stay scalar)
+
+__attribute__((target("sse2")))
+static void u8_to_s16_sse2(int16_t* out, const uint8_t* in, size_t n) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i offset = _mm_set1_epi16(128);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i*) &in[i]);
+        _mm_storeu_si128((__m128i*) &out[i],     _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(x, zero), offset), 8));
+        _mm_storeu_si128((__m128i*) &out[i + 8], _mm_slli_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(x, zero), offset), 8));
+    }
+    u8_to_s16_scalar(&out[i], &in[i], n - i);
+}
+
+__attribute__((target("sse2")))
+static void s32_to_f32_sse2(float* out, const uint8_t* in, size_t n) {
+    const __m128 scale = _mm_set1_ps(S32_SCALE);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m128i x = _mm_loadu_si128((const __m128i*) &in[i * 4]);
+        _mm_storeu_ps(&out[i], _mm_mul_ps(_mm_cvtepi32_ps(x), scale));
+    }
+    s32_to_f32_scalar(&out[i], &in[i * 4], n - i);
+}
+
+__attribute__((target("sse2")))
+static void f64_to_f32_sse2(float* out, const uint8_t* in, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m128 a = _mm_cvtpd_ps(_mm_loadu_pd((const double*) &in[i * 8]));
+        const __m128 b = _mm_cvtpd_ps(_mm_loadu_pd((const double*) &in[i * 8 + 16]));
+        _mm_storeu_ps(&out[i], _mm_movelh_ps(a, b));
+    }
+    f64_to_f32_scalar(&out[i], &in[i * 8], n - i);
+}
+
+// Frames are seen as int32 : the left sample is the low half and the right one the high half
+__attribute__((target("sse2")))
+static void deinterleave2_s16_sse2(int16_t* left, int16_t* right, const uint8_t* in, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m128i a = _mm_loadu_si128((const __m128i*) &in[i * 4]);
+        const __m128i b = _mm_loadu_si128((const __m128i*) &in[i * 4 + 16]);
+        const __m128i la = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+        const __m128i lb = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+        _mm_storeu_si128((__m128i*) &left[i],  _mm_packs_epi32(la, lb));
+        _mm_storeu_si128((__m128i*) &right[i], _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16)));
+    }
+    deinterleave2_scalar<int16_t>(&left[i], &right[i], &in[i * 4], n - i);
+}
+
+__attribute__((target("sse2")))
+static void deinterleave2_f32_sse2(float* left, float* right, const uint8_t* in, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m128 a = _mm_loadu_ps((const float*) &in[i * 8]);
+        const __m128 b = _mm_loadu_ps((const float*) &in[i * 8 + 16]);
+        _mm_storeu_ps(&left[i],  _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(&right[i], _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+    deinterleave2_scalar<float>(&left[i], &right[i], &in[i * 8], n - i);
+}
+
+static const PcmKernels SSE2_KERNELS = {
+    "sse2",
+    u8_to_s16_sse2,
+    s24_to_f32_scalar,
+    s32_to_f32_sse2,
+    f64_to_f32_sse2,
+    deinterleave2_s16_sse2,
+    deinterleave2_f32_sse2,
+    deinterleaven_scalar<int16_t>,
+    deinterleaven_scalar<float>
+};
+
+
+// AVX2 kernels
+
+__attribute__((target("avx2")))
+static void u8_to_s16_avx2(int16_t* out, const uint8_t* in, size_t n) {
+    const __m256i offset = _mm256_set1_epi16(128);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m256i x = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) &in[i]));
+        _mm256_storeu_si256((__m256i*) &out[i], _mm256_slli_epi16(_mm256_sub_epi16(x, offset), 8));
+    }
+    u8_to_s16_scalar(&out[i], &in[i], n - i);
+}
+
+// Each 128 bits lane gets 4 samples (12 bytes), they are moved to the high bytes of int32 then shifted back with their sign
+__attribute__((target("avx2")))
+static void s24_to_f32_avx2(float* out, const uint8_t* in, size_t n) {
+    const __m256i shuffle = _mm256_setr_epi8(
+        -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+        -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11
+    );
+    const __m256 scale = _mm256_set1_ps(S24_SCALE);
+    size_t i = 0;
+    // 28 bytes are loaded for 8 samples (24 bytes)
+    for (; i + 10 <= n; i += 8) {
+        const __m128i lo = _mm_loadu_si128((const __m128i*) &in[i * 3]);
+        const __m128i hi = _mm_loadu_si128((const __m128i*) &in[i * 3 + 12]);
+        const __m256i x = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1), shuffle);
+        _mm256_storeu_ps(&out[i], _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(x, 8)), scale));
+    }
+    s24_to_f32_scalar(&out[i], &in[i * 3], n - i);
+}
+
+__attribute__((target("avx2")))
+static void s32_to_f32_avx2(float* out, const uint8_t* in, size_t n) {
+    const __m256 scale = _mm256_set1_ps(S32_SCALE);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256i x = _mm256_loadu_si256((const __m256i*) &in[i * 4]);
+        _mm256_storeu_ps(&out[i], _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+    }
+    s32_to_f32_scalar(&out[i], &in[i * 4], n - i);
+}
+
+__attribute__((target("avx2")))
+static void f64_to_f32_avx2(float* out, const uint8_t* in, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m128 a = _mm256_cvtpd_ps(_mm256_loadu_pd((const double*) &in[i * 8]));
+        const __m128 b = _mm256_cvtpd_ps(_mm256_loadu_pd((const double*) &in[i * 8 + 32]));
+        _mm256_storeu_ps(&out[i], _mm256_insertf128_ps(_mm256_castps128_ps256(a), b, 1));
+    }
+    f64_to_f32_scalar(&out[i], &in[i * 8], n - i);
+}
+
+// Packs work inside 128 bits lanes, the 64 bits quarters are put back in order after them
+__attribute__((target("avx2")))
+static void deinterleave2_s16_avx2(int16_t* left, int16_t* right, const uint8_t* in, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m256i a = _mm256_loadu_si256((const __m256i*) &in[i * 4]);
+        const __m256i b = _mm256_loadu_si256((const __m256i*) &in[i * 4 + 32]);
+        const __m256i la = _mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16);
+        const __m256i lb = _mm256_srai_epi32(_mm256_slli_epi32(b, 16), 16);
+        const __m256i l = _mm256_packs_epi32(la, lb);
+        const __m256i r = _mm256_packs_epi32(_mm256_srai_epi32(a, 16), _mm256_srai_epi32(b, 16));
+        _mm256_storeu_si256((__m256i*) &left[i],  _mm256_permute4x64_epi64(l, _MM_SHUFFLE(3, 1, 2, 0)));
+        _mm256_storeu_si256((__m256i*) &right[i], _mm256_permute4x64_epi64(r, _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+    deinterleave2_scalar<int16_t>(&left[i], &right[i], &in[i * 4], n - i);
+}
+
+__attribute__((target("avx2")))
+static void deinterleave2_f32_avx2(float* left, float* right, const uint8_t* in, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256 a = _mm256_loadu_ps((const float*) &in[i * 8]);
+        const __m256 b = _mm256_loadu_ps((const float*) &in[i * 8 + 32]);
+        const __m256d l = _mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        const __m256d r = _mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+        _mm256_storeu_ps(&left[i],  _mm256_castpd_ps(_mm256_permute4x64_pd(l, _MM_SHUFFLE(3, 1, 2, 0))));
+        _mm256_storeu_ps(&right[i], _mm256_castpd_ps(_mm256_permute4x64_pd(r, _MM_SHUFFLE(3, 1, 2, 0))));
+    }
+    deinterleave2_scalar<float>(&left[i], &right[i], &in[i * 8], n - i);
+}
+
+// Each channel is gathered with a stride of the number of channels, whatever their number
+// int16 samples are gathered as int32 (the sample and the next one), the loop stops one frame before the end so the
+// last gathers don't read past the samples
+__attribute__((target("avx2")))
+static void deinterleaven_s16_avx2(int16_t** out, int64_t start, const uint8_t* in, size_t n, int32_t nb_channels) {
+    const __m256i frames = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(nb_channels));
+    const __m256i next = _mm256_set1_epi32(8 * nb_channels);
+    size_t i = 0;
+    for (; i + 17 <= n; i += 16) {
+        const int* const base = (const int*) &in[i * nb_channels * 2];
+        __m256i index = frames;
+        for (int32_t j = 0; j < nb_channels; j++) {
+            const __m256i a = _mm256_i32gather_epi32(base, index, 2);
+            const __m256i b = _mm256_i32gather_epi32(base, _mm256_add_epi32(index, next), 2);
+            const __m256i la = _mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16);
+            const __m256i lb = _mm256_srai_epi32(_mm256_slli_epi32(b, 16), 16);
+            _mm256_storeu_si256((__m256i*) &out[j][start + i], _mm256_permute4x64_epi64(_mm256_packs_epi32(la, lb), _MM_SHUFFLE(3, 1, 2, 0)));
+            index = _mm256_add_epi32(index, _mm256_set1_epi32(1));
+        }
+    }
+    deinterleaven_scalar<int16_t>(out, start + i, &in[i * nb_channels * 2], n - i, nb_channels);
+}
+
+__attribute__((target("avx2")))
+static void deinterleaven_f32_avx2(float** out, int64_t start, const uint8_t* in, size_t n, int32_t nb_channels) {
+    const __m256i frames = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(nb_channels));
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const float* const base = (const float*) &in[i * nb_channels * 4];
+        __m256i index = frames;
+        for (int32_t j = 0; j < nb_channels; j++) {
+            _mm256_storeu_ps(&out[j][start + i], _mm256_i32gather_ps(base, index, 4));
+            index = _mm256_add_epi32(index, _mm256_set1_epi32(1));
+        }
+    }
+    deinterleaven_scalar<float>(out, start + i, &in[i * nb_channels * 4], n - i, nb_channels);
+}
+
+static const PcmKernels AVX2_KERNELS = {
+    "avx2",
+    u8_to_s16_avx2,
+    s24_to_f32_avx2,
+    s32_to_f32_avx2,
+    f64_to_f32_avx2,
+    deinterleave2_s16_avx2,
+    deinterleave2_f32_avx2,
+    deinterleaven_s16_avx2,
+    deinterleaven_f32_avx2
+};
+
+#endif
+
+
+static const PcmKernels* best_kernels() {
+#ifdef CONVERT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return &AVX2_KERNELS;
+    if (__builtin_cpu_supports("sse2")) return &SSE2_KERNELS;
+#endif
+    return &SCALAR_KERNELS;
+}
+
+static const PcmKernels* kernels = best_kernels();
+
+
+const char* pcm_kernels_name() {
+    return kernels->name;
+}
+
+
+bool pcm_select_kernels(const char* name) {
+    const PcmKernels* selected = nullptr;
+    if (strcmp(name, "scalar") == 0) selected = &SCALAR_KERNELS;
+#ifdef CONVERT_X86
+    __builtin_cpu_init();
+    if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2")) selected = &SSE2_KERNELS;
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) selected = &AVX2_KERNELS;
+#endif
+    if (selected) kernels = selected;
+    return selected != nullptr;
+}
+
+
+size_t pcm_sample_size(PcmFormat format) {
+    switch (format) {
+        case PCM_U8:  return 1;
+        case PCM_S16: return 2;
+        case PCM_S24: return 3;
+        case PCM_S32: return 4;
+        case PCM_F32: return 4;
+        case PCM_F64: return 8;
+    }
+    return 0;
+}
+
+
+SampleFormat pcm_storage_format(PcmFormat format) {
+    return (format == PCM_U8 || format == PCM_S16) ? SAMPLE_FMT_INT16 : SAMPLE_FMT_FLOAT32;
+}
+
+
+// Deinterleave samples already in the stored format
+template<typename T>
+static void deinterleave(T** out, int64_t start, const uint8_t* in, int64_t count, int32_t nb_channels) {
+    if (nb_channels == 1) {
+        memcpy(&out[0][start], in, count * sizeof(T));
+    }
+    else if (nb_channels == 2) {
+        if constexpr (sizeof(T) == sizeof(int16_t)) kernels->deinterleave2_s16(&out[0][start], &out[1][start], in, count);
+        else kernels->deinterleave2_f32(&out[0][start], &out[1][start], in, count);
+    }
+    else {
+        if constexpr (sizeof(T) == sizeof(int16_t)) kernels->deinterleaven_s16(out, start, in, count, nb_channels);
+        else kernels->deinterleaven_f32(out, start, in, count, nb_channels);
+    }
+}
+
+
+void pcm_deinterleave(void** out, int64_t start, const uint8_t* raw, int64_t count, int32_t nb_channels, PcmFormat format) {
+    if (format == PCM_S16) {
+        deinterleave<int16_t>((int16_t**) out, start, raw, count, nb_channels);
+        return;
+    }
+    if (format == PCM_F32) {
+        deinterleave<float>((float**) out, start, raw, count, nb_channels);
+        return;
+    }
+
+    // Convert a chunk of contiguous samples then deinterleave it
+    const size_t ssize = pcm_sample_size(format);
+    const int64_t chunk_frames = CONVERT_CHUNK / nb_channels;
+    alignas(64) uint8_t tmp[CONVERT_CHUNK * sizeof(float)];
+
+    for (int64_t i = 0; i < count; i += chunk_frames) {
+        const int64_t frames = min<int64_t>(chunk_frames, count - i);
+        const size_t n = frames * nb_channels;
+        const uint8_t* in = &raw[i * nb_channels * ssize];
+
+        switch (format) {
+            case PCM_U8:  kernels->u8_to_s16((int16_t*) tmp, in, n); break;
+            case PCM_S24: kernels->s24_to_f32((float*) tmp, in, n); break;
+            case PCM_S32: kernels->s32_to_f32((float*) tmp, in, n); break;
+            case PCM_F64: kernels->f64_to_f32((float*) tmp, in, n); break;
+            default: break;
+        }
+
+        if (format == PCM_U8) {
+            deinterleave<int16_t>((int16_t**) out, start + i, tmp, frames, nb_channels);
+        } else {
+            deinterleave<float>((float**) out, start + i, tmp, frames, nb_channels);
+        }
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+// Convert interleaved PCM samples of files to planar channels
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "audio.h"
+
+
+#define PCM_MAX_CHANNELS 256
+
+
+// Layout of the samples in files (little endian)
+enum PcmFormat : uint8_t {
+    PCM_U8,
+    PCM_S16,
+    PCM_S24,
+    PCM_S32,
+    PCM_F32,
+    PCM_F64
+};
+
+
+// Size of one sample in bytes
+size_t pcm_sample_size(PcmFormat format);
+
+// Format of the channels converted from a PCM format (int16 up to 16 bits, float above)
+SampleFormat pcm_storage_format(PcmFormat format);
+
+// Deinterleave and convert frames, sample i of channel j is written at out[j][start + i]
+// Channels are int16_t or float according to pcm_storage_format(), raw doesn't need to be aligned
+// There must be at most PCM_MAX_CHANNELS channels
+void pcm_deinterleave(void** out, int64_t start, const uint8_t* raw, int64_t count, int32_t nb_channels, PcmFormat format);
+
+// Instruction set used by the conversions ("avx2", "sse2" or "scalar"), the best one is selected at startup
+const char* pcm_kernels_name();
+
+// Force an instruction set (for benchmarks), return false if it is not supported by the CPU
+bool pcm_select_kernels(const char* name);
@@ -3,6 +3,7 @@
 #include <math.h>
 
 #include "utils.h"
+#include "simd.h"
 
 #include <iostream>
 
@@ -170,6 +171,9 @@ Extractor::Extractor() : histogram(0) {
     freqs = nullptr;
     nb_freqs = 0;
     cursor = 0;
+    window_width = 0;
+    min_freq = 0.f;
+    max_freq = 0.f;
     audio = nullptr;
     all_periods_sums = nullptr;
     all_periods_data = nullptr;
@@ -189,20 +193,21 @@ void Extractor::set_audio(Audio* audio) {
 }
 
 
-void Extractor::forward(float duration) {
-    cursor += duration * audio->rate;
+// Cursors are computed in double so they stay exact for samples counts over 2^24
+void Extractor::forward(double duration) {
+    cursor += llround(duration * audio->rate);
     analyze_all();
 }
 
 
-void Extractor::jump(float time) {
-    cursor = time * audio->rate;
+void Extractor::jump(double time) {
+    cursor = llround(time * audio->rate);
     analyze_all();
 }
 
 
-float Extractor::get_cursor() const {
-    return (float) cursor / (float) audio->rate;
+double Extractor::get_cursor() const {
+    return (double) cursor / (double) audio->rate;
 }
 
 
@@ -218,12 +223,25 @@ void Extractor::set_window_width(float duration) {
 }
 
 
+// Every entry of the histogram is rewritten, even the ones of periods not advanced yet : changes made to the
+// histogram by its users (like the interpretor) don't last past the next analysis
 void Extractor::analyze_all() {
-    const float* data = audio->get_data(0);
-    for (size_t i = 0, m = nb_freqs; i < m; i++) {
-        float r = analyze(&freqs[i], data);
-        if (!isnan(r)) {
-            histogram.entries[i].value = r;
+    // Periods are added up to half a window and two periods around the cursor
+    audio->require(cursor - window_width - audio->guard, cursor + window_width + audio->guard);
+
+    if (audio->format == SAMPLE_FMT_INT16) {
+        const int16_t* data = audio->get_data<int16_t>(0);
+        for (size_t i = 0, m = nb_freqs; i < m; i++) {
+            float r = analyze<int16_t>(&freqs[i], data);
+            if (!isnan(r)) freqs[i].value = r;
+            histogram.entries[i].value = freqs[i].value;
+        }
+    } else {
+        const float* data = audio->get_data<float>(0);
+        for (size_t i = 0, m = nb_freqs; i < m; i++) {
+            float r = analyze<float>(&freqs[i], data);
+            if (!isnan(r)) freqs[i].value = r;
+            histogram.entries[i].value = freqs[i].value;
         }
     }
 }
@@ -231,7 +249,7 @@ void Extractor::analyze_all() {
 
 void Extractor::gen_audio_ranges() {
     size_t start = 0;
-    for (; NOTES[start].mid < min_freq && start < NB_NOTES; start++);
+    for (; start < NB_NOTES && NOTES[start].mid < min_freq; start++);
 
     size_t end = start;
     for (; end < NB_NOTES && NOTES[end].mid <= max_freq; end++);
@@ -265,6 +283,7 @@ void Extractor::gen_audio_ranges() {
         freqs[j].end_cursor = -0x7FFFFFFF;
         freqs[j].total_shift = 0;
         freqs[j].period_phase = NAN;
+        freqs[j].value = 0.f;
     }
 
     all_periods_sums = (float*) realloc(all_periods_sums, all_periods_sums_len * sizeof(float));
@@ -283,7 +302,10 @@ void Extractor::gen_audio_ranges() {
 }
 
 
-float Extractor::analyze(FrequencyData* range, const float* data) {
+// Samples are read in their storage type and converted to float inside the vector lanes
+// Reads go up to one period after the last analyzed period, the zeroed guard of the audio covers them
+template<typename T>
+float Extractor::analyze(FrequencyData* range, const T* data) {
     const int64_t period_i = range->period_int;
     const int64_t audio_length = audio->length / period_i;
     const int64_t target_cursor = clamp<int64_t>(cursor / period_i, 0, audio_length - 1);
@@ -297,12 +319,12 @@ float Extractor::analyze(FrequencyData* range, const float* data) {
 
     const float k = 2.f * (float) PI / (float) period_i;
 
-    float sin_buff[period_i];
-    for (size_t i = 0; i < period_i; i++)
+    alignas(AUDIO_ALIGNMENT) float sin_buff[period_i];
+    for (int64_t i = 0; i < period_i; i++)
         sin_buff[i] = sinf(k * i);
 
-    float cos_buff[period_i];
-    for (size_t i = 0; i < period_i; i++)
+    alignas(AUDIO_ALIGNMENT) float cos_buff[period_i];
+    for (int64_t i = 0; i < period_i; i++)
         cos_buff[i] = cosf(k * i);
 
     const float min_shift = period_i - max_period;
@@ -312,7 +334,8 @@ float Extractor::analyze(FrequencyData* range, const float* data) {
     float* periods_sum  = range->periods_sum;
     float* periods_data = range->periods_data;
 
-    float avgs[period_i];
+    alignas(AUDIO_ALIGNMENT) float avgs[period_i];
+    alignas(AUDIO_ALIGNMENT) float values[period_i];
 
     float current_phase = range->period_phase;
     float current_shift = range->total_shift;
@@ -351,6 +374,10 @@ float Extractor::analyze(FrequencyData* range, const float* data) {
         for (int64_t i = 0; i < period_i; i++) {
             periods_sum[i] = 0.f;
         }
+        // Periods before the start of the audio are never added but are removed once the window moves past them
+        for (int64_t i = 0; i < nb_periods * period_i; i++) {
+            periods_data[i] = 0.f;
+        }
         add_start_cursor = expected_start_cursor;
         add_end_cursor = expected_end_cursor;
         add_start_index = mod(-nb_left_periods, nb_periods);
@@ -368,9 +395,12 @@ float Extractor::analyze(FrequencyData* range, const float* data) {
         range->periods_data_offset = mod(periods_data_offset + forward, nb_periods);
     }
 
+    const float scale = SampleType<T>::scale;
+    const simd_float vscale = simd_set1(scale);
+
     // Initial average
     float avg = 0.f;
-    for (int64_t i = 0; i < period_i; i++) avg += data[i];
+    for (int64_t i = 0; i < period_i; i++) avg += sample_to_float(data[i]);
     avg /= period_i;
 
     int64_t period_data_index = add_start_index;
@@ -379,17 +409,27 @@ float Extractor::analyze(FrequencyData* range, const float* data) {
 
         // Compute new averages
 
+        const float avg_k = scale / period_i;
         for (int64_t j = 0; j < period_i; j++) {
-            const int index = offset + j;
+            const int64_t index = offset + j;
             avgs[j] = avg;
-            avg += (data[index + half_period_i] - data[index - half_period_i]) / period_i;
+            avg += (float) (data[index + half_period_i] - data[index - half_period_i]) * avg_k;
         }
 
-        // Compute phase to shift if needed
+        // Compute phase to shift if needed (and keep centered values)
 
-        float x = 0, y = 0;
-        for (int64_t j = 0; j < period_i; j++) {
-            float v = data[offset + j] - avgs[j];
+        simd_float vx = simd_zero(), vy = simd_zero();
+        int64_t j = 0;
+        for (; j + SIMD_FLOAT_LEN <= period_i; j += SIMD_FLOAT_LEN) {
+            const simd_float v = simd_sub(simd_mul(simd_loadu(&data[offset + j]), vscale), simd_load(&avgs[j]));
+            simd_store(&values[j], v);
+            vx = simd_fmadd(simd_load(&cos_buff[j]), v, vx);
+            vy = simd_fmadd(simd_load(&sin_buff[j]), v, vy);
+        }
+        float x = simd_hsum(vx), y = simd_hsum(vy);
+        for (; j < period_i; j++) {
+            const float v = sample_to_float(data[offset + j]) - avgs[j];
+            values[j] = v;
             x += cos_buff[j] * v;
             y += sin_buff[j] * v;
         }
@@ -403,12 +443,15 @@ float Extractor::analyze(FrequencyData* range, const float* data) {
         // Add to sum with shift
         const int64_t shift_i = 0;//mod((int64_t) current_shift, period_i);
 
-        const int64_t d = period_data_index * period_i;
-        for (int64_t j = 0; j < period_i; j++) {
-            const float v = data[offset + j] - avgs[j];
-            int64_t index = (j + shift_i) % period_i;
-            periods_data[d + index] = v;
-            periods_sum[index] += v;
+        // Done in two contiguous parts so the copy and the sum are vectorized
+        float* const period_data = &periods_data[period_data_index * period_i];
+        for (int64_t j = 0, m = period_i - shift_i; j < m; j++) {
+            period_data[j + shift_i] = values[j];
+            periods_sum[j + shift_i] += values[j];
+        }
+        for (int64_t j = period_i - shift_i; j < period_i; j++) {
+            period_data[j + shift_i - period_i] = values[j];
+            periods_sum[j + shift_i - period_i] += values[j];
         }
 
         period_data_index = mod(period_data_index + 1, nb_periods);
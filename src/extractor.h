@@ -35,6 +35,7 @@ struct FrequencyData {
     int32_t period_int;
     float total_shift;
     float period_phase;
+    float value; // Last analyzed strength, kept while the cursor stays in the same period
 };
 
 
@@ -61,7 +62,8 @@ private:
     float* all_periods_data;
     int64_t cursor;
 
-    float analyze(FrequencyData* range, const float* data);
+    template<typename T>
+    float analyze(FrequencyData* range, const T* data);
     void analyze_all();
     void gen_audio_ranges();
 
@@ -75,13 +77,13 @@ public:
     void set_audio(Audio* audio);
 
     // Forward analyze by duration
-    void forward(float duration);
+    void forward(double duration);
 
     // Set begin of analyze window offset in second from the begining of the audio
-    void jump(float time);
+    void jump(double time);
 
     // Get current begin of analyze window offset in seconds from the begining of the audio
-    float get_cursor() const;
+    double get_cursor() const;
 
     inline float get_min_freq() const { return min_freq; }
     inline float get_max_freq() const { return max_freq; }
@@ -0,0 +1,667 @@
+#include "flac.h"
+
+#include "thread_pool.h"
+#include "utils.h"
+
+#include <string.h>
+#include <inttypes.h>
+#include <atomic>
+
+
+static inline uint32_t read_be(const uint8_t* p, int nb_bytes) {
+    uint32_t v = 0;
+    for (int i = 0; i < nb_bytes; i++) v = (v << 8) | p[i];
+    return v;
+}
+
+
+int flac_parse_header(FILE* file, flac_info_t* info) {
+    uint8_t hdr[10];
+
+    if (fread(hdr, 1, 4, file) != 4) {
+        return 2;
+    }
+
+    // ID3v2 tag before the stream (its size is coded on 7 bits per byte)
+    if (memcmp(hdr, "ID3", 3) == 0) {
+        if (fread(&hdr[4], 1, 6, file) != 6) {
+            return 2;
+        }
+        const int64_t size = ((hdr[6] & 0x7F) << 21) | ((hdr[7] & 0x7F) << 14) | ((hdr[8] & 0x7F) << 7) | (hdr[9] & 0x7F);
+        const int64_t footer = (hdr[5] & 0x10) ? 10 : 0;
+        if (file_seek(file, size + footer, SEEK_CUR) || fread(hdr, 1, 4, file) != 4) {
+            return 2;
+        }
+    }
+
+    if (memcmp(hdr, "fLaC", 4) != 0) {
+        return 20;
+    }
+
+    // Metadata blocks : 1 bit last block flag, 7 bits type, 24 bits size
+    bool has_stream_info = false;
+    bool last = false;
+    while (!last) {
+        if (fread(hdr, 1, 4, file) != 4) {
+            return 21;
+        }
+        last = hdr[0] & 0x80;
+        const int type = hdr[0] & 0x7F;
+        const uint32_t size = read_be(&hdr[1], 3);
+
+        if (type == 0) {
+            uint8_t si[34];
+            if (size < sizeof(si) || fread(si, 1, sizeof(si), file) != sizeof(si)) {
+                return 21;
+            }
+            info->min_block_size = read_be(&si[0], 2);
+            info->max_block_size = read_be(&si[2], 2);
+            info->max_frame_size = read_be(&si[7], 3);
+            info->frequency = read_be(&si[10], 3) >> 4;
+            info->nb_channels = ((si[12] >> 1) & 0x07) + 1;
+            info->sample_width = (((si[12] & 0x01) << 4) | (si[13] >> 4)) + 1;
+            info->nb_samples = ((int64_t) (si[13] & 0x0F) << 32) | read_be(&si[14], 4);
+            has_stream_info = true;
+            if (file_seek(file, size - sizeof(si), SEEK_CUR)) {
+                return 7;
+            }
+        }
+        else if (file_seek(file, size, SEEK_CUR)) {
+            return 7;
+        }
+    }
+
+    if (!has_stream_info) {
+        return 21;
+    }
+
+    // The length is needed to allocate the channels
+    if (info->sample_width > FLAC_MAX_SAMPLE_WIDTH || info->sample_width < 4 || info->nb_samples == 0 || info->max_block_size < 16) {
+        return 22;
+    }
+
+    info->data_offset = file_tell(file);
+    if (file_seek(file, 0, SEEK_END)) {
+        return 13;
+    }
+    info->data_size = file_tell(file) - info->data_offset;
+    if (file_seek(file, info->data_offset, SEEK_SET)) {
+        return 13;
+    }
+
+    return 0;
+}
+
+
+void flac_print_info(const flac_info_t* info) {
+    printf("Data size : %" PRId64 "\n", info->data_size);
+    printf("Nb channels : %i\n", info->nb_channels);
+    printf("Sample width : %i\n", info->sample_width);
+    printf("Nb samples : %" PRId64 "\n", info->nb_samples * info->nb_channels);
+    printf("Frequency : %i\n", info->frequency);
+
+    fflush(stdout);
+}
+
+
+SampleFormat flac_storage_format(const flac_info_t* info) {
+    return info->sample_width <= 16 ? SAMPLE_FMT_INT16 : SAMPLE_FMT_FLOAT32;
+}
+
+
+// CRC of frame headers (polynomial x^8 + x^2 + x + 1) and of whole frames (x^16 + x^15 + x^2 + 1)
+
+struct FlacCrcTables {
+    uint8_t crc8[256];
+    uint16_t crc16[256];
+
+    constexpr FlacCrcTables() : crc8(), crc16() {
+        for (int i = 0; i < 256; i++) {
+            uint8_t c8 = i;
+            uint16_t c16 = i << 8;
+            for (int b = 0; b < 8; b++) {
+                c8 = (c8 & 0x80) ? (c8 << 1) ^ 0x07 : (c8 << 1);
+                c16 = (c16 & 0x8000) ? (c16 << 1) ^ 0x8005 : (c16 << 1);
+            }
+            crc8[i] = c8;
+            crc16[i] = c16;
+        }
+    }
+};
+
+static constexpr FlacCrcTables CRC_TABLES;
+
+static uint8_t crc8(const uint8_t* data, size_t size) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < size; i++) crc = CRC_TABLES.crc8[crc ^ data[i]];
+    return crc;
+}
+
+static uint16_t crc16(const uint8_t* data, size_t size) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < size; i++) crc = (crc << 8) ^ CRC_TABLES.crc16[(crc >> 8) ^ data[i]];
+    return crc;
+}
+
+
+// Read bits from the most significant one, the valid bits are at the top of the cache
+// Bytes after the end are read as zeros and reported by overflow()
+struct FlacBitReader {
+    const uint8_t* data;
+    size_t size;
+    size_t pos; // Next byte to load in the cache
+    uint64_t cache;
+    int32_t bits;
+
+    FlacBitReader(const uint8_t* data, size_t size) : data(data), size(size), pos(0), cache(0), bits(0) {}
+
+    inline void refill() {
+        while (bits <= 56) {
+            const uint64_t byte = pos < size ? data[pos] : 0;
+            cache |= byte << (56 - bits);
+            pos++;
+            bits += 8;
+        }
+    }
+
+    inline void skip(int32_t n) {
+        cache = n >= 64 ? 0 : cache << n;
+        bits -= n;
+    }
+
+    // n from 0 to 32
+    inline uint32_t read(int32_t n) {
+        if (n == 0) return 0;
+        if (bits < n) refill();
+        const uint32_t v = (uint32_t) (cache >> (64 - n));
+        skip(n);
+        return v;
+    }
+
+    inline int32_t read_signed(int32_t n) {
+        if (n == 0) return 0;
+        return (int32_t) (read(n) << (32 - n)) >> (32 - n);
+    }
+
+    // Number of zeros before the next one
+    inline uint32_t read_unary() {
+        uint32_t count = 0;
+        while (true) {
+            if (bits == 0) {
+                if (pos > size + 8) return 0;
+                refill();
+            }
+            if (cache == 0) {
+                count += bits;
+                skip(bits);
+                continue;
+            }
+            const int32_t zeros = __builtin_clzll(cache);
+            if (zeros < bits) {
+                skip(zeros + 1);
+                return count + zeros;
+            }
+            count += bits;
+            skip(bits);
+        }
+    }
+
+    inline void align() {
+        skip(bits % 8);
+    }
+
+    // Bytes read so far (once aligned)
+    inline size_t byte_pos() const {
+        return pos - bits / 8;
+    }
+
+    inline bool overflow() const {
+        return pos * 8 - bits > size * 8;
+    }
+};
+
+
+FlacDecoder::FlacDecoder(const flac_info_t* info) {
+    this->info = info;
+    all_samples = (int32_t*) malloc((size_t) info->max_block_size * info->nb_channels * sizeof(int32_t));
+    for (int32_t j = 0; j < FLAC_MAX_CHANNELS; j++) {
+        samples[j] = j < info->nb_channels ? &all_samples[(size_t) info->max_block_size * j] : nullptr;
+    }
+    frame = {0, 0, 0};
+}
+
+
+FlacDecoder::~FlacDecoder() {
+    free(all_samples);
+}
+
+
+// Rice coded residual of a subframe, written after the warmup samples
+static int decode_residual(FlacBitReader* br, int32_t* out, int32_t nb_samples, int32_t order) {
+    const uint32_t method = br->read(2);
+    if (method > 1) return 24;
+    const int32_t param_bits = method == 0 ? 4 : 5;
+    const uint32_t escape = method == 0 ? 15 : 31;
+
+    const int32_t partition_order = br->read(4);
+    const int32_t partition_len = nb_samples >> partition_order;
+    if ((partition_len << partition_order) != nb_samples || partition_len < order) return 24;
+
+    int32_t i = order;
+    for (int32_t p = 0; p < (1 << partition_order); p++) {
+        const int32_t end = (p + 1) * partition_len;
+        const uint32_t param = br->read(param_bits);
+
+        if (param == escape) {
+            const int32_t width = br->read(5);
+            for (; i < end; i++) out[i] = br->read_signed(width);
+            continue;
+        }
+
+        for (; i < end; i++) {
+            const uint32_t v = (br->read_unary() << param) | br->read(param);
+            out[i] = (int32_t) (v >> 1) ^ -(int32_t) (v & 1);
+        }
+
+        if (br->overflow()) return FLAC_ERR_TRUNCATED;
+    }
+
+    return 0;
+}
+
+
+// Add the prediction of fixed polynomial predictors to the residual
+static void restore_fixed(int32_t* s, int32_t nb_samples, int32_t order) {
+    switch (order) {
+        case 1:
+            for (int32_t i = 1; i < nb_samples; i++) s[i] += s[i - 1];
+            break;
+        case 2:
+            for (int32_t i = 2; i < nb_samples; i++) s[i] += 2 * s[i - 1] - s[i - 2];
+            break;
+        case 3:
+            for (int32_t i = 3; i < nb_samples; i++) s[i] += 3 * s[i - 1] - 3 * s[i - 2] + s[i - 3];
+            break;
+        case 4:
+            for (int32_t i = 4; i < nb_samples; i++) s[i] += 4 * s[i - 1] - 6 * s[i - 2] + 4 * s[i - 3] - s[i - 4];
+            break;
+    }
+}
+
+
+// Add the prediction of the LPC coefficients to the residual
+// Sums fit in 32 bits for usual precisions and widths, 64 bits are only used otherwise
+template<typename S>
+static void restore_lpc(int32_t* s, int32_t nb_samples, const int32_t* coefs, int32_t order, int32_t shift) {
+    for (int32_t i = order; i < nb_samples; i++) {
+        S sum = 0;
+        for (int32_t j = 0; j < order; j++) sum += (S) coefs[j] * s[i - 1 - j];
+        s[i] += (int32_t) (sum >> shift);
+    }
+}
+
+
+int FlacDecoder::decode_subframe(FlacBitReader* br, int32_t* out, int32_t nb_samples, int32_t width) {
+    if (br->read(1)) return 24;
+    const uint32_t type = br->read(6);
+
+    int32_t wasted = 0;
+    if (br->read(1)) {
+        wasted = br->read_unary() + 1;
+        width -= wasted;
+        if (width <= 0) return 24;
+    }
+
+    if (type == 0) {
+        const int32_t v = br->read_signed(width);
+        for (int32_t i = 0; i < nb_samples; i++) out[i] = v;
+    }
+    else if (type == 1) {
+        for (int32_t i = 0; i < nb_samples; i++) out[i] = br->read_signed(width);
+    }
+    else if (type >= 8 && type <= 12) {
+        const int32_t order = type - 8;
+        if (order > nb_samples) return 24;
+        for (int32_t i = 0; i < order; i++) out[i] = br->read_signed(width);
+        const int r = decode_residual(br, out, nb_samples, order);
+        if (r) return r;
+        restore_fixed(out, nb_samples, order);
+    }
+    else if (type >= 32) {
+        const int32_t order = type - 31;
+        if (order > nb_samples) return 24;
+        for (int32_t i = 0; i < order; i++) out[i] = br->read_signed(width);
+
+        const int32_t precision = br->read(4) + 1;
+        const int32_t shift = br->read_signed(5);
+        if (precision == 16 || shift < 0) return 24;
+
+        int32_t coefs[32];
+        for (int32_t j = 0; j < order; j++) coefs[j] = br->read_signed(precision);
+
+        const int r = decode_residual(br, out, nb_samples, order);
+        if (r) return r;
+
+        int32_t order_bits = 0;
+        while ((1 << order_bits) < order) order_bits++;
+        if (width + precision + order_bits <= 32) {
+            restore_lpc<int32_t>(out, nb_samples, coefs, order, shift);
+        } else {
+            restore_lpc<int64_t>(out, nb_samples, coefs, order, shift);
+        }
+    }
+    else {
+        return 24;
+    }
+
+    if (wasted) {
+        for (int32_t i = 0; i < nb_samples; i++) out[i] <<= wasted;
+    }
+
+    return br->overflow() ? FLAC_ERR_TRUNCATED : 0;
+}
+
+
+static const int32_t FRAME_RATES[12] = {0, 88200, 176400, 192000, 8000, 16000, 22050, 24000, 32000, 44100, 48000, 96000};
+static const int32_t FRAME_WIDTHS[8] = {0, 8, 12, 0, 16, 20, 24, 32};
+
+
+int FlacDecoder::decode(const uint8_t* data, size_t size) {
+    if (size < 6) return FLAC_ERR_TRUNCATED;
+
+    // Sync code (14 bits), reserved bit and blocking strategy
+    if (data[0] != 0xFF || (data[1] & 0xFE) != 0xF8) return 23;
+    const bool variable_blocks = data[1] & 0x01;
+
+    const int32_t size_code = data[2] >> 4;
+    const int32_t rate_code = data[2] & 0x0F;
+    const int32_t channels_code = data[3] >> 4;
+    const int32_t width_code = (data[3] >> 1) & 0x07;
+    if (size_code == 0 || rate_code == 15 || channels_code > 10 || width_code == 3 || (data[3] & 0x01)) return 23;
+
+    // Frame or sample number coded like UTF-8 (up to 36 bits)
+    size_t pos = 4;
+    int32_t nb_extra = 0;
+    uint64_t number = data[pos];
+    if (number == 0xFF) return 23;
+    if (number >= 0x80) {
+        while (number & (0x40 >> nb_extra)) nb_extra++;
+        if (nb_extra == 0) return 23;
+        number &= 0x3F >> nb_extra;
+    }
+    pos++;
+    if (pos + nb_extra + 5 > size) return FLAC_ERR_TRUNCATED;
+    for (int32_t i = 0; i < nb_extra; i++, pos++) {
+        if ((data[pos] & 0xC0) != 0x80) return 23;
+        number = (number << 6) | (data[pos] & 0x3F);
+    }
+
+    int32_t nb_samples;
+    if (size_code == 1) nb_samples = 192;
+    else if (size_code <= 5) nb_samples = 576 << (size_code - 2);
+    else if (size_code == 6) nb_samples = data[pos++] + 1;
+    else if (size_code == 7) { nb_samples = read_be(&data[pos], 2) + 1; pos += 2; }
+    else nb_samples = 256 << (size_code - 8);
+
+    if (rate_code == 12) pos += 1;
+    else if (rate_code >= 13) pos += 2;
+
+    if (pos + 1 > size) return FLAC_ERR_TRUNCATED;
+    if (crc8(data, pos) != data[pos]) return 23;
+    pos++;
+
+    const int32_t nb_channels = channels_code < 8 ? channels_code + 1 : 2;
+    const int32_t width = width_code == 0 ? info->sample_width : FRAME_WIDTHS[width_code];
+    if (nb_channels != info->nb_channels || width != info->sample_width || nb_samples > info->max_block_size) return 23;
+    if (rate_code > 0 && rate_code < 12 && FRAME_RATES[rate_code] != (int32_t) info->frequency) return 23;
+
+    // Subframes, the side channel has one more bit
+    FlacBitReader br(&data[pos], size - pos);
+    for (int32_t j = 0; j < nb_channels; j++) {
+        const bool side = (channels_code == 8 && j == 1) || (channels_code == 9 && j == 0) || (channels_code == 10 && j == 1);
+        const int r = decode_subframe(&br, samples[j], nb_samples, width + side);
+        if (r) return r;
+    }
+
+    br.align();
+    const size_t end = pos + br.byte_pos();
+    if (end + 2 > size) return FLAC_ERR_TRUNCATED;
+    if (crc16(data, end) != read_be(&data[end], 2)) return 25;
+
+    int32_t* left = samples[0];
+    int32_t* right = samples[1];
+    switch (channels_code) {
+        case 8: // Left and side
+            for (int32_t i = 0; i < nb_samples; i++) right[i] = left[i] - right[i];
+            break;
+        case 9: // Side and right
+            for (int32_t i = 0; i < nb_samples; i++) left[i] += right[i];
+            break;
+        case 10: // Mid and side
+            for (int32_t i = 0; i < nb_samples; i++) {
+                const int32_t side = right[i];
+                const int32_t mid = (int32_t) ((uint32_t) left[i] << 1) | (side & 1);
+                left[i] = (mid + side) >> 1;
+                right[i] = (mid - side) >> 1;
+            }
+            break;
+    }
+
+    const int64_t block_size = (!variable_blocks && info->min_block_size == info->max_block_size) ? info->min_block_size : nb_samples;
+    frame.sample = variable_blocks ? (int64_t) number : (int64_t) number * block_size;
+    frame.nb_samples = nb_samples;
+    frame.size = end + 2;
+
+    return 0;
+}
+
+
+int64_t FlacDecoder::find(const uint8_t* data, size_t size) {
+    for (size_t i = 0; i + 1 < size; i++) {
+        if (data[i] == 0xFF && (data[i + 1] & 0xFE) == 0xF8 && decode(&data[i], size - i) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+void FlacDecoder::write(void** out, SampleFormat format, int64_t start, int64_t end) const {
+    start = max<int64_t>(start, frame.sample);
+    end = min<int64_t>(end, frame.sample + frame.nb_samples);
+    if (start >= end) return;
+
+    const int32_t* const* in = samples;
+    const int64_t offset = start - frame.sample;
+    const int64_t count = end - start;
+
+    if (format == SAMPLE_FMT_INT16) {
+        const int32_t shift = 16 - info->sample_width;
+        for (int32_t j = 0; j < info->nb_channels; j++) {
+            int16_t* o = &((int16_t*) out[j])[start];
+            const int32_t* s = &in[j][offset];
+            for (int64_t i = 0; i < count; i++) o[i] = (int16_t) (s[i] << shift);
+        }
+    } else {
+        const float scale = 1.f / (float) ((1 << (info->sample_width - 1)) - 1);
+        for (int32_t j = 0; j < info->nb_channels; j++) {
+            float* o = &((float*) out[j])[start];
+            const int32_t* s = &in[j][offset];
+            for (int64_t i = 0; i < count; i++) o[i] = (float) s[i] * scale;
+        }
+    }
+}
+
+
+int flac_decode_all(const uint8_t* data, size_t size, const flac_info_t* info, void** out, SampleFormat format, ThreadPool* pool) {
+    const int64_t nb_chunks = clamp<int64_t>(size / FLAC_CHUNK_SIZE, 1, pool->get_nb_threads() * 4);
+    std::atomic<int> error(0);
+
+    pool->parallel_for(nb_chunks, [&](int64_t k) {
+        const size_t chunk_start = size * k / nb_chunks;
+        const size_t chunk_end = size * (k + 1) / nb_chunks;
+        FlacDecoder decoder(info);
+
+        // The first chunk starts with a frame, the others at the first frame found in them
+        size_t offset = chunk_start;
+        if (k == 0) {
+            const int r = decoder.decode(data, size);
+            if (r) {
+                if (r != FLAC_ERR_TRUNCATED) error = r;
+                return;
+            }
+        } else {
+            const int64_t found = decoder.find(&data[chunk_start], size - chunk_start);
+            if (found < 0 || chunk_start + found >= chunk_end) return;
+            offset += found;
+        }
+
+        while (true) {
+            decoder.write(out, format, 0, info->nb_samples);
+            offset += decoder.get_frame().size;
+            if (offset >= chunk_end) break;
+
+            // Frames cut by the end of the file are ignored
+            const int r = decoder.decode(&data[offset], size - offset);
+            if (r == FLAC_ERR_TRUNCATED) break;
+            if (r) {
+                error = r;
+                break;
+            }
+        }
+    });
+
+    return error;
+}
+
+
+FlacReader::FlacReader(FILE* file, const flac_info_t* info) : decoder(info) {
+    this->file = file;
+    this->info = info;
+    has_frame = false;
+    buff_capacity = FLAC_CHUNK_SIZE;
+    buff = (uint8_t*) malloc(buff_capacity);
+    buff_offset = 0;
+    buff_len = 0;
+    next_offset = 0;
+    next_sample = 0;
+}
+
+
+FlacReader::~FlacReader() {
+    free(buff);
+}
+
+
+// Make at least min_len bytes from offset available in the buffer (less at the end of the file)
+// Return the number of bytes available from offset
+size_t FlacReader::fill(int64_t offset, size_t min_len) {
+    if (offset >= buff_offset && offset + (int64_t) min_len <= buff_offset + (int64_t) buff_len) {
+        return buff_offset + buff_len - offset;
+    }
+
+    if (min_len > buff_capacity) {
+        buff_capacity = align_up(min_len, FLAC_CHUNK_SIZE);
+        buff = (uint8_t*) realloc(buff, buff_capacity);
+    }
+
+    // Keep the bytes already read after offset
+    size_t kept = 0;
+    if (offset >= buff_offset && offset < buff_offset + (int64_t) buff_len) {
+        kept = buff_offset + buff_len - offset;
+        memmove(buff, &buff[offset - buff_offset], kept);
+    }
+
+    buff_offset = offset;
+    buff_len = kept;
+
+    const int64_t pos = info->data_offset + offset + kept;
+    const size_t len = min<int64_t>(buff_capacity - kept, max<int64_t>(info->data_size - offset - kept, 0));
+    if (len > 0 && file_seek(file, pos, SEEK_SET) == 0) {
+        buff_len += fread(&buff[kept], 1, len, file);
+    }
+
+    return buff_len;
+}
+
+
+// Decode the frame at next_offset, or the first valid one after it if it is corrupted
+int FlacReader::decode_next() {
+    if (next_offset >= info->data_size) return FLAC_ERR_TRUNCATED;
+
+    size_t len = fill(next_offset, info->max_frame_size ? info->max_frame_size : FLAC_SEEK_DISTANCE);
+    int r = decoder.decode(&buff[next_offset - buff_offset], len);
+
+    // The frame is bigger than expected, read more
+    while (r == FLAC_ERR_TRUNCATED && next_offset + (int64_t) len < info->data_size) {
+        len = fill(next_offset, len * 2);
+        r = decoder.decode(&buff[next_offset - buff_offset], len);
+    }
+
+    if (r == FLAC_ERR_TRUNCATED) {
+        return r;
+    }
+
+    if (r) {
+        const int64_t found = decoder.find(&buff[next_offset - buff_offset + 1], len - 1);
+        if (found < 0) {
+            has_frame = false;
+            next_offset += len;
+            return r;
+        }
+        next_offset += found + 1;
+    }
+
+    has_frame = true;
+    next_offset += decoder.get_frame().size;
+    next_sample = decoder.get_frame().sample + decoder.get_frame().nb_samples;
+    return 0;
+}
+
+
+// Bisect the file for a frame starting at or before a sample
+void FlacReader::seek(int64_t sample) {
+    int64_t lo = 0, lo_sample = 0;
+    int64_t hi = info->data_size;
+
+    while (hi - lo > FLAC_SEEK_DISTANCE) {
+        const int64_t mid = lo + (hi - lo) / 2;
+        const size_t len = fill(mid, min<int64_t>(hi - mid, FLAC_SEEK_DISTANCE));
+        const int64_t found = decoder.find(&buff[mid - buff_offset], len);
+
+        if (found < 0 || decoder.get_frame().sample > sample) {
+            hi = mid;
+        } else {
+            lo = mid + found;
+            lo_sample = decoder.get_frame().sample;
+            if (sample < lo_sample + decoder.get_frame().nb_samples) break;
+        }
+    }
+
+    has_frame = false;
+    next_offset = lo;
+    next_sample = lo_sample;
+}
+
+
+int FlacReader::read(void** out, SampleFormat format, int64_t start, int64_t count) {
+    const int64_t end = start + count;
+
+    // The last frame decoded can hold the begining of the range, otherwise seek if the range is far
+    const flac_frame_t& frame = decoder.get_frame();
+    const bool in_frame = has_frame && frame.sample <= start && start < frame.sample + frame.nb_samples;
+    if (!in_frame && (start < next_sample || start - next_sample > FLAC_SKIP_SAMPLES)) {
+        seek(start);
+    }
+
+    if (has_frame) decoder.write(out, format, start, end);
+
+    int r = 0;
+    while (next_sample < end) {
+        r = decode_next();
+        if (r == FLAC_ERR_TRUNCATED) break;
+        if (has_frame) decoder.write(out, format, start, end);
+    }
+
+    return r == FLAC_ERR_TRUNCATED ? 0 : r;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+// Decode FLAC files
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "audio.h"
+
+
+#define FLAC_MAX_CHANNELS 8
+#define FLAC_MAX_SAMPLE_WIDTH 24
+#define FLAC_CHUNK_SIZE (1 << 20) // Minimum number of bytes of frames decoded by each parallel job
+#define FLAC_SEEK_DISTANCE (1 << 16) // Seeks bisect the file down to this many bytes then decode the frames up to the wanted one
+#define FLAC_SKIP_SAMPLES (1 << 18) // Frames are decoded up to the wanted ones instead of seeking when they are closer than this
+
+#define FLAC_ERR_TRUNCATED 26 // The data ends before the end of the frame
+
+
+class ThreadPool;
+
+
+typedef struct {
+    uint16_t min_block_size; // Samples per frame (all frames but the last one have the same size if min == max)
+    uint16_t max_block_size;
+    uint32_t max_frame_size; // In bytes, 0 if unknown
+    uint32_t frequency;
+    uint16_t nb_channels;
+    uint16_t sample_width; // In bits
+    int64_t nb_samples; // Number of samples per channel
+    int64_t data_offset; // Offset of the first frame from the begining of the file
+    int64_t data_size; // Size of the frames
+} flac_info_t;
+
+
+typedef struct {
+    int64_t sample; // Position of the first sample of the frame
+    int32_t nb_samples;
+    size_t size; // In bytes
+} flac_frame_t;
+
+
+// Parse the metadata blocks, the file is left at the first frame
+// Return 0 on success or an error code
+int flac_parse_header(FILE* file, flac_info_t* info);
+
+// Print informations of a FLAC file
+void flac_print_info(const flac_info_t* info);
+
+// Format of the decoded channels (int16 up to 16 bits, float above)
+SampleFormat flac_storage_format(const flac_info_t* info);
+
+
+// Decode frames one by one into planar int32 samples (one decoder per thread)
+class FlacDecoder {
+private:
+    const flac_info_t* info;
+    int32_t* samples[FLAC_MAX_CHANNELS]; // Samples of the last decoded frame
+    int32_t* all_samples;
+    flac_frame_t frame;
+
+    int decode_subframe(struct FlacBitReader* br, int32_t* out, int32_t nb_samples, int32_t width);
+
+public:
+    FlacDecoder(const flac_info_t* info);
+    ~FlacDecoder();
+
+    // Decode the frame at the begining of data
+    // Return 0 on success, FLAC_ERR_TRUNCATED if data ends inside the frame or an error code
+    int decode(const uint8_t* data, size_t size);
+
+    // Decode the first valid frame of data, return its offset or -1 if there is none
+    int64_t find(const uint8_t* data, size_t size);
+
+    // Last decoded frame
+    inline const flac_frame_t& get_frame() const { return frame; }
+
+    // Convert the samples of the last frame from start to end (excluded, clamped to the frame) into planar channels
+    void write(void** out, SampleFormat format, int64_t start, int64_t end) const;
+};
+
+
+// Decode all the frames of a file in memory (data starts at the first frame) into planar channels of
+// info->nb_samples samples, the data is cut in chunks decoded in parallel (each one starts at its first valid frame)
+// Return 0 on success or an error code
+int flac_decode_all(const uint8_t* data, size_t size, const flac_info_t* info, void** out, SampleFormat format, ThreadPool* pool);
+
+
+// Decode ranges of samples of a file, reading it by parts and seeking to the frames of the ranges
+class FlacReader {
+private:
+    FILE* file;
+    const flac_info_t* info;
+    FlacDecoder decoder;
+    bool has_frame; // The decoder holds a frame just before next_offset
+
+    // Part of the file in memory (offsets from the first frame)
+    uint8_t* buff;
+    size_t buff_capacity;
+    int64_t buff_offset;
+    size_t buff_len;
+
+    int64_t next_offset; // Next frame to decode
+    int64_t next_sample;
+
+    size_t fill(int64_t offset, size_t min_len);
+    int decode_next();
+    void seek(int64_t sample);
+
+public:
+    // The file stays owned by the caller
+    FlacReader(FILE* file, const flac_info_t* info);
+    ~FlacReader();
+
+    // Decode samples from start to start + count into planar channels
+    // Return 0 on success or an error code (the samples not decoded are left untouched)
+    int read(void** out, SampleFormat format, int64_t start, int64_t count);
+};
@@ -1,16 +1,16 @@
 #include "interpretor.h"
 
 #include "sort.h"
+#include "simd.h"
 #include "utils.h"
 
 #include <math.h>
+#include <string.h>
 
 
 /*
 TODO :
-    - Local minimum threshold based on the average amplitude of last x seconds
     - Undo average on last histogrames for each frequency based on window width
-    - Minimum note duration and minimum note cut duration
 */
 
 
@@ -18,8 +18,8 @@ struct HistogramEntryRef {
     float strength;
     uint32_t index;
 
-    // Operator override needed to perform sorting
-    inline bool operator>(const HistogramEntryRef& other) {
+    // Operator override needed to rank the entries
+    inline bool operator>(const HistogramEntryRef& other) const {
         return strength > other.strength;
     }
 };
@@ -28,13 +28,72 @@ struct HistogramEntryRef {
 Interpretor::Interpretor() {
     histo = nullptr;
     current_histo_lenght = 0;
+    current_histo_freq = 0.f;
     human_adjust_coefs = nullptr;
+    nb_harmony_diagonals = 0;
+    harmony_pad = 0;
+    peek_neighbourhood = 1;
+    peek_keep_ratio = 1.f;
+    scratch = nullptr;
+    harmony_values = nullptr;
+    harmony_scores = nullptr;
+    smoothed_values = nullptr;
+    smoothing = SMOOTHING_NONE;
+    smoothing_window = 1;
+    smoothing_alpha = 1.f;
+    nb_smoothed_frames = 0;
+    top_entries = nullptr;
+    top_capacity = 0;
+    threshold_window = 0;
+    nb_allocations = 0;
+}
+
+
+Interpretor::~Interpretor() {
+    free(human_adjust_coefs);
+    free(scratch);
+    free(top_entries);
 }
 
 
 void Interpretor::check_histo() {
-    if (current_histo_lenght != histo->nb_entries) {
+    const size_t nb_entries = histo->nb_entries;
+    if (current_histo_lenght != nb_entries) {
+        gen_harmony_template();
+        alloc_scratch();
+        gen_human_adjust_coefs();
+    } else if (nb_entries > 0 && current_histo_freq != histo->entries[0].freq) {
+        const size_t pad = harmony_pad;
+        gen_harmony_template();
+        if (harmony_pad != pad) alloc_scratch();
         gen_human_adjust_coefs();
+        stats.clear(); // The entries are other frequencies
+        medians.clear();
+        nb_smoothed_frames = 0;
+    }
+}
+
+
+// One block for all the arrays used while analyzing a histogram
+void Interpretor::alloc_scratch() {
+    const size_t nb_entries = histo->nb_entries;
+    const size_t values_len = harmony_pad + nb_entries + harmony_pad + SIMD_FLOAT_LEN;
+    free(scratch);
+    scratch = malloc((values_len + nb_entries + SIMD_FLOAT_LEN + nb_entries) * sizeof(float));
+    harmony_values = (float*) scratch;
+    harmony_scores = &harmony_values[values_len];
+    smoothed_values = &harmony_scores[nb_entries + SIMD_FLOAT_LEN];
+    nb_smoothed_frames = 0;
+    memset(harmony_values, 0, values_len * sizeof(float)); // Only the strengths are written, the padding stays null
+    nb_allocations++;
+
+    if (threshold_window > 0) {
+        stats.resize(nb_entries, threshold_window);
+        nb_allocations++;
+    }
+    if (smoothing == SMOOTHING_MEDIAN) {
+        medians.resize(nb_entries, smoothing_window);
+        nb_allocations++;
     }
 }
 
@@ -92,10 +151,15 @@ static float get_human_adjust_coef(float freq) {
 void Interpretor::gen_human_adjust_coefs() {
     const size_t nb_entries = histo->nb_entries;
     HistogramEntry* entries = histo->entries;
-    human_adjust_coefs = (float*) realloc(human_adjust_coefs, nb_entries * sizeof(float));
+    if (current_histo_lenght != nb_entries) {
+        human_adjust_coefs = (float*) realloc(human_adjust_coefs, nb_entries * sizeof(float));
+        nb_allocations++;
+    }
     for (size_t i = 0; i < nb_entries; i++) {
         human_adjust_coefs[i] = get_human_adjust_coef(entries[i].freq);
     }
+    current_histo_lenght = nb_entries;
+    current_histo_freq = nb_entries > 0 ? entries[0].freq : 0.f;
 }
 
 
@@ -108,57 +172,190 @@ void Interpretor::set_extractor(Extractor* extractor) {
 
 void Interpretor::adjust_to_human_hear() {
     check_histo();
+    adjust_entries_to_human_hear(histo->entries);
+}
+
+
+void Interpretor::adjust_entries_to_human_hear(HistogramEntry* entries) const {
     const size_t nb_entries = histo->nb_entries;
-    HistogramEntry* entries = histo->entries;
     for (size_t i = 0; i < nb_entries; i++) {
         entries[i].value *= human_adjust_coefs[i];
     }
 }
 
 
-static inline void lower_unharmony(HistogramEntry* entries, size_t index, bool* lowereds, size_t nb_entries) {
-    lowereds[index] = true;
-    for (size_t i = max<size_t>(0, index - 3); i < index; i++) {
-        entries[i].value *= .5f;
-        lowereds[i] = true;
-    }
-    for (size_t i = index + 1, m = min<size_t>(nb_entries, index + 3); i <= m; i++) {
-        entries[i].value *= .5f;
-        lowereds[i] = true;
+void Interpretor::set_smoothing(InterpretorSmoothing smoothing, double duration, double fps) {
+    const size_t window = max<size_t>(lround(duration * fps), 1);
+    this->smoothing = smoothing;
+    smoothing_window = window;
+    smoothing_alpha = 1.f - expf(-1.f / window);
+    nb_smoothed_frames = 0;
+
+    if (smoothing == SMOOTHING_MEDIAN && histo) {
+        medians.resize(histo->nb_entries, window);
+        nb_allocations++;
     }
 }
 
 
-void Interpretor::keep_harmony() {
+void Interpretor::smooth() {
     check_histo();
 
     const size_t nb_entries = histo->nb_entries;
     HistogramEntry* entries = histo->entries;
 
-    HistogramEntryRef* sorted = new HistogramEntryRef[nb_entries];
-    for (size_t i = 0; i < nb_entries; i++) {
-        sorted[i].index = i;
-        sorted[i].strength = entries[i].value;
+    if (smoothing == SMOOTHING_MEDIAN) {
+        for (size_t i = 0; i < nb_entries; i++) medians.push(i, entries[i].value);
+        medians.next_frame();
+        for (size_t i = 0; i < nb_entries; i++) entries[i].value = medians.median(i);
+    } else if (smoothing == SMOOTHING_EXPONENTIAL) {
+        // The average starts at the first frame
+        if (nb_smoothed_frames == 0) {
+            for (size_t i = 0; i < nb_entries; i++) smoothed_values[i] = entries[i].value;
+        }
+        for (size_t i = 0; i < nb_entries; i++) {
+            smoothed_values[i] += smoothing_alpha * (entries[i].value - smoothed_values[i]);
+            entries[i].value = smoothed_values[i];
+        }
+        nb_smoothed_frames++;
+    }
+}
+
+
+// Entries are spaced by a constant frequency ratio (semitones from the extractor) : the k-th harmonic of every entry is
+// the same number of entries higher, each harmonic is a diagonal of the template
+void Interpretor::gen_harmony_template() {
+    const size_t nb_entries = histo->nb_entries;
+    HistogramEntry* entries = histo->entries;
+    nb_harmony_diagonals = 0;
+    harmony_pad = 0;
+    if (nb_entries < 2) return;
+
+    const double log_ratio = log((double) entries[1].freq / entries[0].freq);
+    for (int32_t k = 2; k <= INTERPRETOR_NB_HARMONICS; k++) {
+        const int32_t offset = (int32_t) lround(log((double) k) / log_ratio);
+        if (offset <= 0 || (size_t) offset >= nb_entries) continue;
+
+        // Higher harmonics are weaker
+        const float weight = 1.f / k;
+        harmony_offsets[nb_harmony_diagonals] = offset;
+        harmony_weights[nb_harmony_diagonals++] = weight;
+        harmony_offsets[nb_harmony_diagonals] = -offset;
+        harmony_weights[nb_harmony_diagonals++] = -weight;
+        harmony_pad = max<size_t>(harmony_pad, offset);
     }
+}
 
-    sort(sorted, nb_entries);
 
-    bool* lowereds = new bool[nb_entries] {};
+void Interpretor::keep_harmony() {
+    check_histo();
+    keep_entries_harmony(histo->entries, harmony_values, harmony_scores);
+}
+
+
+void Interpretor::keep_entries_harmony(HistogramEntry* entries, float* padded_values, float* scores) const {
+    const size_t nb_entries = histo->nb_entries;
 
-    for (size_t i = nb_entries; i-- > 0;) {
-        const size_t index = sorted[i].index;
-        if (!lowereds[index])
-            lower_unharmony(entries, index, lowereds, nb_entries);
+    float* values = &padded_values[harmony_pad];
+    for (size_t i = 0; i < nb_entries; i++) values[i] = entries[i].value;
+
+    // Each diagonal of the template is a load shifted by its offset (the padding reads as null strengths)
+    // An entry only gets from the others up to its own strength : entries under a note (its subharmonics) stay weak
+    for (size_t i = 0; i < nb_entries; i += SIMD_FLOAT_LEN) {
+        const simd_float value = simd_loadu(&values[i]);
+        simd_float score = value;
+        for (int32_t d = 0; d < nb_harmony_diagonals; d++) {
+            const simd_float other = simd_min(simd_loadu(&values[(ptrdiff_t) i + harmony_offsets[d]]), value);
+            score = simd_fmadd(simd_set1(harmony_weights[d]), other, score);
+        }
+        simd_storeu(&scores[i], simd_max(score, simd_zero()));
     }
 
-    delete[] lowereds;
-    delete[] sorted;
+    for (size_t i = 0; i < nb_entries; i++) entries[i].value = scores[i];
+}
+
+
+void Interpretor::set_peeks(size_t neighbourhood, float prominence) {
+    peek_neighbourhood = min<size_t>(max<size_t>(neighbourhood, 1), INTERPRETOR_MAX_PEEK_NEIGHBOURHOOD);
+    peek_keep_ratio = 1.f - min(max(prominence, 0.f), 1.f);
+}
+
+
+// Entries at the ends of the histogram only have the neighbours inside it
+// Ties : the first entry of a plateau is the peek
+static bool is_peek(const HistogramEntry* entries, size_t nb_entries, size_t index, size_t neighbourhood, float keep_ratio) {
+    const float value = entries[index].value;
+    float lowest = value;
+    for (size_t i = index > neighbourhood ? index - neighbourhood : 0; i < index; i++) {
+        if (entries[i].value >= value) return false;
+        lowest = min(lowest, entries[i].value);
+    }
+    for (size_t i = index + 1; i < nb_entries && i <= index + neighbourhood; i++) {
+        if (entries[i].value > value) return false;
+        lowest = min(lowest, entries[i].value);
+    }
+    return value * keep_ratio >= lowest;
 }
 
 
 void Interpretor::keep_peeks() {
     check_histo();
-    // TODO
+    keep_entries_peeks(histo->entries);
+}
+
+
+void Interpretor::keep_entries_peeks(HistogramEntry* entries) const {
+    const size_t nb_entries = histo->nb_entries;
+    const size_t neighbourhood = peek_neighbourhood;
+
+    // The strengths are read in place : the odd floats of the entries
+    const float* pairs = (const float*) entries;
+    const simd_float keep_ratio = simd_set1(peek_keep_ratio);
+
+    // A block of SIMD_FLOAT_LEN entries is zeroed once no block left to analyze reads it : the masks of the peeks
+    // of the last blocks wait in a ring
+    const size_t lag = (neighbourhood + SIMD_FLOAT_LEN - 1) / SIMD_FLOAT_LEN + 1;
+    uint32_t masks[INTERPRETOR_MAX_PEEK_NEIGHBOURHOOD + 1];
+    const size_t nb_blocks = (nb_entries + SIMD_FLOAT_LEN - 1) / SIMD_FLOAT_LEN;
+
+    size_t slot = 0;
+    for (size_t block = 0; block < nb_blocks + lag; block++) {
+        if (block >= lag) {
+            const size_t start = (block - lag) * SIMD_FLOAT_LEN;
+            const size_t end = min(start + SIMD_FLOAT_LEN, nb_entries);
+            for (size_t i = start; i < end; i++) {
+                if (!(masks[slot] >> (i - start) & 1)) entries[i].value = 0.f;
+            }
+        }
+
+        if (block < nb_blocks) {
+            const size_t start = block * SIMD_FLOAT_LEN;
+            uint32_t mask = 0;
+            if (start >= neighbourhood && start + SIMD_FLOAT_LEN + neighbourhood <= nb_entries) {
+                const simd_float value = simd_loadu_odd(&pairs[2 * start]);
+                simd_float left = simd_loadu_odd(&pairs[2 * (start - 1)]);
+                simd_float right = simd_loadu_odd(&pairs[2 * (start + 1)]);
+                simd_float lowest = simd_min(left, right);
+                for (size_t o = 2; o <= neighbourhood; o++) {
+                    const simd_float l = simd_loadu_odd(&pairs[2 * (start - o)]);
+                    const simd_float r = simd_loadu_odd(&pairs[2 * (start + o)]);
+                    left = simd_max(left, l);
+                    right = simd_max(right, r);
+                    lowest = simd_min(lowest, simd_min(l, r));
+                }
+                mask = simd_mask_greater(value, left) & simd_mask_greater_equal(value, right)
+                     & simd_mask_greater_equal(simd_mul(value, keep_ratio), lowest);
+            } else {
+                const size_t end = min(start + SIMD_FLOAT_LEN, nb_entries);
+                for (size_t i = start; i < end; i++) {
+                    mask |= (uint32_t) is_peek(entries, nb_entries, i, neighbourhood, peek_keep_ratio) << (i - start);
+                }
+            }
+            masks[slot] = mask;
+        }
+
+        slot = slot + 1 < lag ? slot + 1 : 0;
+    }
 }
 
 
@@ -168,116 +365,203 @@ void Interpretor::adjust_to_speaker_physics() {
 }
 
 
+void Interpretor::set_threshold_window(double duration, double fps) {
+    const size_t window = duration > 0. ? max<size_t>(lround(duration * fps), 1) : 0;
+    if (window == threshold_window) return;
+
+    threshold_window = window;
+    if (window > 0 && histo) {
+        stats.resize(histo->nb_entries, window);
+        nb_allocations++;
+    }
+}
+
+
 size_t Interpretor::extract_notes(Note* output, size_t maximum) {
     check_histo();
 
     const size_t nb_entries = histo->nb_entries;
     HistogramEntry* entries = histo->entries;
+    if (nb_entries == 0) return 0;
 
-    HistogramEntryRef* sorted = new HistogramEntryRef[nb_entries];
-    for (size_t i = 0; i < nb_entries; i++) {
-        sorted[i].index = i;
-        sorted[i].strength = entries[i].value;
+    float threshold = get_entries_threshold(entries);
+
+    // Not below the level of the last seconds (quiet parts don't give notes from their noise)
+    if (threshold_window > 0) {
+        for (size_t i = 0; i < nb_entries; i++) stats.push(i, entries[i].value);
+        stats.next_frame();
+        threshold = max(threshold, stats.mean() + sqrtf(stats.variance()));
     }
 
-    sort(sorted, nb_entries);
+    if (maximum > top_capacity) {
+        top_entries = (HistogramEntryRef*) realloc(top_entries, maximum * sizeof(HistogramEntryRef));
+        top_capacity = maximum;
+        nb_allocations++;
+    }
+    return select_notes(entries, threshold, output, maximum, top_entries);
+}
 
-    float best_threshold = 0.f;
 
-    // Find the best threshold
+// Threshold : mean strength plus the mean gap between two consecutive strengths once sorted
+// (the gaps of the sorted strengths add up to the range of the strengths, no sort is needed)
+float Interpretor::get_entries_threshold(const HistogramEntry* entries) const {
+    const size_t nb_entries = histo->nb_entries;
+    float sum = 0.f;
+    float min_strength = entries[0].value;
+    float max_strength = entries[0].value;
+    for (size_t i = 0; i < nb_entries; i++) {
+        const float v = entries[i].value;
+        sum += v;
+        min_strength = min(min_strength, v);
+        max_strength = max(max_strength, v);
+    }
+    return sum / nb_entries + (max_strength - min_strength) / (nb_entries - 1);
+}
 
-/*
-    float best_score = 0.f;
-    for (size_t i = 0, m = nb_entries - 1; i < m; i++) {
-        const float delta = sorted[i + 1].strength - sorted[i].strength;
-        if (delta > best_score) {
-            best_score = delta;
-            best_threshold = sorted[i].strength + delta * .5f;
+
+// Strongest entries above the threshold, in the order of a sort from the strongest
+size_t Interpretor::select_notes(const HistogramEntry* entries, float threshold, Note* output, size_t maximum, HistogramEntryRef* top) const {
+    const size_t nb_entries = histo->nb_entries;
+    size_t n = 0;
+    for (size_t i = 0; i < nb_entries; i++) {
+        if (entries[i].value > threshold) {
+            top_insert(top, &n, maximum, HistogramEntryRef {entries[i].value, (uint32_t) i});
         }
     }
-*/
 
-    float variance = 0.f;
-    best_threshold = sorted[0].strength;
-    for (size_t i = 1; i < nb_entries; i++) {
-        best_threshold += sorted[i].strength;
-        variance += abs(sorted[i].strength - sorted[i - 1].strength);
+    for (size_t i = 0; i < n; i++) {
+        const size_t index = top[i].index;
+        output[i].freq     = entries[index].freq;
+        const float k = human_adjust_coefs[index];
+        output[i].strength = entries[index].value / (k*k);
     }
-    best_threshold /= nb_entries;
-    best_threshold += variance / (nb_entries - 1);
 
-/*
-    float best_score = 0.f;
+    return n;
+}
 
-    float right_avg = 0.f;
-    for (size_t i = 0; i < nb_entries; i++)
-        right_avg += sorted[i].strength;
-    right_avg /= nb_entries;
 
-    float left_avg = 0.f;
+// The entries are smoothed independently : each job smooths a range of entries over all the frames
+void Interpretor::smooth_batch(float* strengths, size_t nb_frames, ThreadPool& pool) const {
+    const size_t nb_entries = histo->nb_entries;
+    const int64_t nb_jobs = (nb_entries + INTERPRETOR_BATCH_ENTRIES - 1) / INTERPRETOR_BATCH_ENTRIES;
+
+    pool.parallel_for(nb_jobs, [&](int64_t job) {
+        const size_t first = job * INTERPRETOR_BATCH_ENTRIES;
+        const size_t n = min<size_t>(INTERPRETOR_BATCH_ENTRIES, nb_entries - first);
+
+        if (smoothing == SMOOTHING_MEDIAN) {
+            RunningMedian job_medians;
+            job_medians.resize(n, smoothing_window);
+            for (size_t f = 0; f < nb_frames; f++) {
+                float* values = &strengths[f * nb_entries + first];
+                for (size_t i = 0; i < n; i++) job_medians.push(i, values[i]);
+                job_medians.next_frame();
+                for (size_t i = 0; i < n; i++) values[i] = job_medians.median(i);
+            }
+        } else if (smoothing == SMOOTHING_EXPONENTIAL) {
+            float averages[INTERPRETOR_BATCH_ENTRIES];
+            memcpy(averages, &strengths[first], n * sizeof(float));
+            for (size_t f = 0; f < nb_frames; f++) {
+                float* values = &strengths[f * nb_entries + first];
+                for (size_t i = 0; i < n; i++) {
+                    averages[i] += smoothing_alpha * (values[i] - averages[i]);
+                    values[i] = averages[i];
+                }
+            }
+        }
+    });
+}
 
-    for (size_t i = 0, m = nb_entries - 1; i < m; i++) {
-        const float nb_right_values = (float) (nb_entries - i);
-        const float k1 = 1.f / (nb_right_values - 1.f);
-        right_avg = right_avg * (nb_right_values * k1) - sorted[i].strength * k1;
 
-        const float nb_left_values = (float) (i);
-        const float k2 = 1.f / (nb_left_values + 1.f);
-        left_avg  = left_avg  * (nb_right_values * k2) + sorted[i].strength * k2;
+size_t Interpretor::extract_notes_batch(float* strengths, size_t nb_frames, uint32_t stages, Note* output, size_t* nb_notes, size_t maximum,
+                                        ThreadPool& pool) {
+    check_histo();
 
-        const float score = right_avg - left_avg;
-        if (score > best_score) {
-            best_score = score;
-            best_threshold = (left_avg + right_avg) * .5f;
-        }
+    const size_t nb_entries = histo->nb_entries;
+    if (nb_entries == 0 || nb_frames == 0) {
+        for (size_t f = 0; f < nb_frames; f++) nb_notes[f] = 0;
+        return 0;
     }
-*/
-
-/*
-    float best_score = INFINITY;
 
-    float right_avg = 0.f;
-    float right_weight = 0.f;
-    for (size_t i = 0; i < nb_entries; i++) {
-        right_avg += i * sorted[i].strength;
-        right_weight += sorted[i].strength;
-    }
-    right_avg /= right_weight;
-
-    float left_avg = 0.f;
-    float left_weight = 0.f;
-
-    for (size_t i = 0, m = nb_entries - 1; i < m; i++) {
-        right_avg = right_avg * right_weight - i * sorted[i].strength;
-        right_weight -= sorted[i].strength;
-        if (right_weight > 0) right_avg /= right_weight;
-        else right_avg = nb_entries - 1;
-
-        left_avg = left_avg * left_weight + i * sorted[i].strength;
-        left_weight += sorted[i].strength;
-        if (left_weight > 0) left_avg /= left_weight;
-        else left_avg = 0;
-
-        const float score = abs((right_avg - i) - (i - left_avg));
-        if (score < best_score) {
-            best_score = score;
-            best_threshold = entries[i].value;
+    // The smoothing is sequential in time : it runs over all the frames before the other stages
+    if (stages & STAGE_SMOOTH) smooth_batch(strengths, nb_frames, pool);
+
+    // Threshold of each frame, then sums of its strengths when the threshold adapts to the last frames
+    float* thresholds = (float*) malloc(nb_frames * sizeof(float));
+    double* sums = threshold_window > 0 ? (double*) malloc(2 * nb_frames * sizeof(double)) : nullptr;
+    double* sums_sq = sums ? &sums[nb_frames] : nullptr;
+
+    // Each job analyzes a range of frames in its own scratch memory, the notes are selected in the same pass when the
+    // thresholds don't depend on the other frames
+    const size_t values_len = harmony_pad + nb_entries + harmony_pad + SIMD_FLOAT_LEN;
+    const int64_t nb_jobs = (nb_frames + INTERPRETOR_BATCH_FRAMES - 1) / INTERPRETOR_BATCH_FRAMES;
+    auto analyze = [&](int64_t job, bool select) {
+        const size_t first = job * INTERPRETOR_BATCH_FRAMES;
+        const size_t last = min<size_t>(first + INTERPRETOR_BATCH_FRAMES, nb_frames);
+
+        void* memory = malloc(nb_entries * sizeof(HistogramEntry) + maximum * sizeof(HistogramEntryRef)
+                              + (values_len + nb_entries + SIMD_FLOAT_LEN) * sizeof(float));
+        HistogramEntry* entries = (HistogramEntry*) memory;
+        HistogramEntryRef* top = (HistogramEntryRef*) &entries[nb_entries];
+        float* padded_values = (float*) &top[maximum];
+        float* scores = &padded_values[values_len];
+        memset(padded_values, 0, values_len * sizeof(float));
+        memcpy(entries, histo->entries, nb_entries * sizeof(HistogramEntry));
+
+        for (size_t f = first; f < last; f++) {
+            float* values = &strengths[f * nb_entries];
+            for (size_t i = 0; i < nb_entries; i++) entries[i].value = values[i];
+
+            // The second pass of the adaptive threshold reads the strengths analyzed by the first one
+            if (!select || !sums) {
+                if (stages & STAGE_HUMAN_HEAR) adjust_entries_to_human_hear(entries);
+                if (stages & STAGE_HARMONY) keep_entries_harmony(entries, padded_values, scores);
+                if (stages & STAGE_PEEKS) keep_entries_peeks(entries);
+                thresholds[f] = get_entries_threshold(entries);
+                for (size_t i = 0; i < nb_entries; i++) values[i] = entries[i].value;
+
+                if (sums) {
+                    double sum = 0., sum_sq = 0.;
+                    for (size_t i = 0; i < nb_entries; i++) {
+                        sum += values[i];
+                        sum_sq += (double) values[i] * values[i];
+                    }
+                    sums[f] = sum;
+                    sums_sq[f] = sum_sq;
+                }
+            }
+
+            if (select) nb_notes[f] = select_notes(entries, thresholds[f], &output[f * maximum], maximum, top);
         }
-    }
-*/
 
-    size_t n = 0;
-    for (size_t i = nb_entries; n < maximum && i-- > 0;) {
-        const size_t index = sorted[i].index;
-        if (entries[index].value > best_threshold) {
-            output[n].freq     = entries[index].freq;
-            const float k = human_adjust_coefs[index];
-            output[n].strength = entries[index].value / (k*k);
-            n++;
+        free(memory);
+    };
+
+    if (sums) {
+        pool.parallel_for(nb_jobs, [&](int64_t job) { analyze(job, false); });
+
+        // Not below the level of the last frames, like the sliding statistics of extract_notes
+        double window_sum = 0., window_sum_sq = 0.;
+        for (size_t f = 0; f < nb_frames; f++) {
+            window_sum += sums[f];
+            window_sum_sq += sums_sq[f];
+            if (f >= threshold_window) {
+                window_sum -= sums[f - threshold_window];
+                window_sum_sq -= sums_sq[f - threshold_window];
+            }
+            const double count = (double) min(f + 1, threshold_window) * nb_entries;
+            const double mean = window_sum / count;
+            const double variance = window_sum_sq / count - mean * mean;
+            thresholds[f] = max(thresholds[f], (float) mean + sqrtf(variance > 0. ? (float) variance : 0.f));
         }
     }
 
-    delete[] sorted;
+    pool.parallel_for(nb_jobs, [&](int64_t job) { analyze(job, true); });
 
-    return n;
+    free(thresholds);
+    free(sums);
+
+    size_t total = 0;
+    for (size_t f = 0; f < nb_frames; f++) total += nb_notes[f];
+    return total;
 }
@@ -4,6 +4,34 @@
 
 
 #include "extractor.h"
+#include "sliding_stats.h"
+#include "running_median.h"
+#include "thread_pool.h"
+
+
+#define INTERPRETOR_NB_HARMONICS 6 // Harmonics scored by keep_harmony (the fundamental is the first one)
+#define INTERPRETOR_MAX_PEEK_NEIGHBOURHOOD 16 // Entries on each side of an entry compared to it by keep_peeks
+#define INTERPRETOR_BATCH_FRAMES 64 // Frames analyzed by each job of extract_notes_batch
+#define INTERPRETOR_BATCH_ENTRIES 32 // Entries smoothed over all the frames by each job of extract_notes_batch
+
+
+struct HistogramEntryRef;
+
+
+enum InterpretorSmoothing : uint8_t {
+    SMOOTHING_NONE,
+    SMOOTHING_MEDIAN, // Median of the strengths of the last frames
+    SMOOTHING_EXPONENTIAL, // Exponential average of the strengths (time constant of the window)
+};
+
+
+// Stages run on each frame by extract_notes_batch, in this order before the extraction of the notes
+enum InterpretorStage : uint32_t {
+    STAGE_SMOOTH = 1 << 0,
+    STAGE_HUMAN_HEAR = 1 << 1,
+    STAGE_HARMONY = 1 << 2,
+    STAGE_PEEKS = 1 << 3,
+};
 
 
 struct Note {
@@ -16,16 +44,64 @@ class Interpretor {
 private:
     Histogram* histo;
     size_t current_histo_lenght;
+    float current_histo_freq; // Frequency of the first entry (the entries change with the frequency domain)
     float* human_adjust_coefs;
 
+    // Harmonic template : a sparse matrix made of diagonals (the entries are spaced by a constant frequency ratio)
+    // An entry is scored with its harmonics (positive weights) and the fundamentals it is a harmonic of (negative ones)
+    int32_t harmony_offsets[2 * (INTERPRETOR_NB_HARMONICS - 1)];
+    float harmony_weights[2 * (INTERPRETOR_NB_HARMONICS - 1)];
+    int32_t nb_harmony_diagonals;
+    size_t harmony_pad; // Largest offset
+
+    // An entry is a peek when it is stronger than the peek_neighbourhood entries on each side of it and its strength
+    // times peek_keep_ratio (1 - prominence) is still above the weakest of them
+    size_t peek_neighbourhood;
+    float peek_keep_ratio;
+
+    // Scratch memory allocated in one block when the length of the histogram changes (nothing is allocated per frame)
+    void* scratch;
+    float* harmony_values; // Strengths with harmony_pad zeros before and after them
+    float* harmony_scores;
+    float* smoothed_values; // Exponential averages of the strengths
+
+    // Temporal smoothing of the strengths of each entry
+    InterpretorSmoothing smoothing;
+    size_t smoothing_window; // In frames
+    float smoothing_alpha; // Weight of the current frame in the exponential average
+    size_t nb_smoothed_frames; // Since the entries changed
+    RunningMedian medians;
+
+    // Strongest entries of the last extraction
+    HistogramEntryRef* top_entries;
+    size_t top_capacity;
+
+    // Strengths of the last frames extracted (the threshold adapts to them when the window isn't empty)
+    SlidingStats stats;
+    size_t threshold_window; // In frames, 0 to only use the current frame
+
+    size_t nb_allocations;
+
     void check_histo();
+    void alloc_scratch();
+    void gen_harmony_template();
 
     void gen_human_adjust_coefs();
 
+    // Stages on any entries with the frequencies of the histogram (the batch analyzes several frames at once)
+    void adjust_entries_to_human_hear(HistogramEntry* entries) const;
+    void keep_entries_harmony(HistogramEntry* entries, float* padded_values, float* scores) const;
+    void keep_entries_peeks(HistogramEntry* entries) const;
+    float get_entries_threshold(const HistogramEntry* entries) const;
+    size_t select_notes(const HistogramEntry* entries, float threshold, Note* output, size_t maximum, HistogramEntryRef* top) const;
+
+    void smooth_batch(float* strengths, size_t nb_frames, ThreadPool& pool) const;
+
 public:
     Extractor* extractor;
 
     Interpretor();
+    ~Interpretor();
 
     // Set extractor to use
     void set_extractor(Extractor* extractor);
@@ -33,15 +109,52 @@ public:
     // Vary strength based on human perception of loudness for each frequencies
     void adjust_to_human_hear();
 
-    // Lower strength of notes that don't make an harmony with a foundamental note
+    // Smooth the strength of each entry over the last frames (histogram flickering from a frame to the next one)
+    // Costs O(entries x log(window)) for the median and O(entries) for the exponential average, without allocation
+    void smooth();
+
+    // Smoothing done by smooth() over the last duration x fps frames : duration seconds when the histogram is analyzed
+    // fps times per second, the window counts frames whatever their hop when it varies
+    void set_smoothing(InterpretorSmoothing smoothing, double duration, double fps);
+
+    // Score each entry as a fundamental against its harmonic series : the harmonics of an entry add to its strength and
+    // the entries it is a harmonic of remove from it (overtones aren't reported as notes)
+    // Costs O(entries x harmonics) with SIMD, without sort nor allocation
     void keep_harmony();
 
-    // Keep peeks (lower frequencies at a flat level with other near frequencies)
+    // Keep only the peeks, the other entries are zeroed (a broad hump gives one note instead of a cluster of notes)
+    // One pass over the histogram in place with SIMD, without copy nor allocation
     void keep_peeks();
 
+    // Entries compared on each side of an entry by keep_peeks (1 to INTERPRETOR_MAX_PEEK_NEIGHBOURHOOD, default 1) and
+    // relative drop of the strength required around a peek (0 to 1, default 0 : any local maximum)
+    void set_peeks(size_t neighbourhood, float prominence);
+
     // Vary strength of notes based the acceleration of the speaker's membrane (lower very high frequencies)
     void adjust_to_speaker_physics();
 
-    // Extract notes of the current histogram
+    // Extract notes of the current histogram (at most maximum, from the strongest)
+    // Only the strongest entries are selected, the histogram isn't sorted
     size_t extract_notes(Note* output, size_t maximum);
+
+    // Extract the notes of nb_frames histograms at once : strengths is a matrix of nb_frames rows of the strengths of the
+    // entries of the histogram (same frequencies), the stages are applied to it in place
+    // The notes of frame f are written at output[f * maximum] and their number at nb_notes[f], return the total
+    // Frames are analyzed in parallel on the pool, only the sliding threshold and the smoothing (over the entries)
+    // are sequential in time. The batch starts from empty statistics and doesn't change the ones of extract_notes
+    // Notes can then be tracked by a NoteTracker frame after frame
+    size_t extract_notes_batch(float* strengths, size_t nb_frames, uint32_t stages, Note* output, size_t* nb_notes, size_t maximum,
+                               ThreadPool& pool = ThreadPool::shared());
+
+    // Threshold of extract_notes at least the mean plus the standard deviation of the strengths extracted during the last
+    // duration seconds (notes extracted fps times per second), 0 to only use the current frame
+    // The cost of a frame doesn't depend on the duration
+    void set_threshold_window(double duration, double fps);
+
+    // Statistics of the strengths of each entry over the threshold window
+    inline const SlidingStats& get_stats() const { return stats; }
+
+    // Number of allocations done by the interpretor (test hook : it doesn't change from a frame to the next one
+    // while the histogram keeps its length and the maximum number of notes doesn't grow)
+    inline size_t get_nb_allocations() const { return nb_allocations; }
 };
@@ -1,43 +1,96 @@
 #include <iostream>
+#include <vector>
+#include <string.h>
 
 #include "utils.h"
+#include "error.h"
 #include "audio.h"
+#include "batch.h"
+#include "sweep.h"
 #include "player.h"
 #include "graphic.h"
 #include "extractor.h"
 #include "interpretor.h"
+#include "onset_detector.h"
+#include "note_tracker.h"
 
 
 constexpr char audio_filename[] = "audios/tetris.wav";
 
 constexpr int nb_notes = 4; // Maximum number of simultaneous notes
 constexpr int nps = 8; // Notes per seconds
-constexpr int fps = 12; // Frame per seconds
+constexpr int fps = 12; // Frame per seconds of the batch and sweep modes (the hop of the main loop adapts to the onsets)
+constexpr int max_fps = 48; // Frame per seconds of the main loop right after the onsets
+constexpr int analysis_rate = 22050; // Rate of the analyzed audio (well above the highest analyzed frequency)
 
 
 extern "C" int main(int argc, char** argv) {
     std::cout << "====== Music to Notes ======" << std::endl << std::endl;
 
+    // Batch mode : music2notes --batch <directory or list of files> [output directory]
+    if (argc >= 3 && strcmp(argv[1], "--batch") == 0) {
+        std::vector<std::string> files;
+        if (batch_list_files(argv[2], &files)) {
+            err("Can't list files");
+        }
+
+        const batch_config_t config = {nb_notes, nps, fps, analysis_rate, argc >= 4 ? argv[3] : ""};
+        return batch_run(files, &config, nullptr) ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    // Sweep mode : music2notes --sweep <audio file> [reference notes written by the batch mode]
+    if (argc >= 3 && strcmp(argv[1], "--sweep") == 0) {
+        if (sweep_run(argv[2], argc >= 4 ? argv[3] : "", nps, fps, analysis_rate, sweep_default_configs(), nullptr)) {
+            err("Can't sweep the configurations");
+        }
+        return EXIT_SUCCESS;
+    }
+
     Audio audio;
+    Audio analysis_audio;
     Graphic graphic;
     Extractor extractor;
+    OnsetDetector detector;
     Interpretor interpretor;
+    NoteTracker tracker(nb_notes);
     MusicPlayer music_player;
     TonesPlayer tones_player;
 
-    // Load audio file in memory
+    // Open the audio file, its samples are decoded when needed
     std::cout << "Loading audio ..." << std::endl;
-    audio.load_wav_file(audio_filename);
+    if (audio.open_file(audio_filename)) {
+        err("Can't load audio file");
+    }
     std::cout << "Audio loaded" << std::endl << std::endl;
 
+    // The extractor only analyzes the first channel
+    audio.convert_to_monochannel();
+
+    // Analyze all files at the same rate so the cost doesn't depend on their rate
+    if (analysis_audio.resample(&audio, analysis_rate)) {
+        err("Can't resample audio");
+    }
+
     // Configure extractor
-    extractor.set_audio(&audio);
+    extractor.set_audio(&analysis_audio);
     extractor.set_window_width(1.f / (float) nps);
     extractor.set_freq_domain(20, 5000);
 
+    // Frames 1/48s apart right after the onsets, up to one window width apart while the notes are held
+    detector.set_hops(1. / max_fps, 1. / nps);
+    detector.set_window_width(1. / nps);
+
     // Configure interpretor
     interpretor.set_extractor(&extractor);
 
+    // Median of the last 3 frames whatever their hop (1/16s after an onset, up to 3/8s while the notes are held) :
+    // a strength flickering for a single frame doesn't start nor cut notes
+    interpretor.set_smoothing(SMOOTHING_MEDIAN, 3. / max_fps, max_fps);
+
+    // Notes shorter than half a note and cuts shorter than half a note are ignored
+    tracker.set_min_duration(.5 / nps);
+    tracker.set_min_cut(.5 / nps);
+
     // Create window
     graphic.create(800, 650);
 
@@ -46,16 +99,23 @@ extern "C" int main(int argc, char** argv) {
     //music_player.play_audio(&audio);
 
     Note notes[nb_notes] {};
+    std::vector<NoteEvent> events(tracker.get_max_events());
     ToneTrack* tracks[nb_notes];
+    int64_t track_notes[nb_notes]; // Id of the note played by each track, -1 if the track is free
 
     for (int i = 0; i < nb_notes; i++) {
         tracks[i] = tones_player.create_track(0);
+        track_notes[i] = -1;
     }
 
     // Main loop
     int64_t last_time = millis();
     while (!graphic.update()) {
+        // Onsets are found on the histogram of the extractor before the interpretor changes it
+        detector.update(&extractor);
+
         // Find top notes (from the histogram of the extractor)
+        interpretor.smooth();
         interpretor.adjust_to_human_hear();
         //interpretor.keep_harmony();
         int n = interpretor.extract_notes(notes, nb_notes);
@@ -64,18 +124,32 @@ extern "C" int main(int argc, char** argv) {
         graphic.clear(Color(0x000000));
         graphic.render_histogram(&extractor.histogram, Color(0xFFFFFF), 8);
 
-        // Play notes
-        for (int i = 0; i < nb_notes; i++) {
-            const float freq = i < n ? notes[i].freq : 0;
-            std::cout << "Note " << i << " : " << freq << std::endl;
-            tracks[i]->set_tone(freq, min(notes[i].strength * 20.f, 0.8f));
+        // Play notes : the tracks only change on the events of the notes
+        const size_t nb_events = tracker.update(notes, n, extractor.get_cursor(), events.data());
+        for (size_t e = 0; e < nb_events; e++) {
+            const NoteEvent& event = events[e];
+            const int64_t wanted = event.type == NOTE_START ? -1 : event.id;
+            int i = 0;
+            while (i < nb_notes && track_notes[i] != wanted) i++;
+            if (i == nb_notes) continue; // No free track for a new note
+
+            if (event.type == NOTE_END) {
+                std::cout << "Note " << event.id << " ends" << std::endl;
+                tracks[i]->set_tone(0, 0);
+                track_notes[i] = -1;
+            } else {
+                std::cout << "Note " << event.id << (event.type == NOTE_START ? " starts : " : " : ") << event.freq << std::endl;
+                tracks[i]->set_tone(event.freq, min(event.strength * 20.f, 0.8f));
+                track_notes[i] = event.id;
+            }
         }
 
         // Forward and update histogram
-        extractor.forward(1.f / (float) fps);
+        const double hop = detector.get_hop();
+        extractor.forward(hop);
 
         int64_t current_time = millis();
-        int64_t wait_time = (1000 / fps) - (current_time - last_time);
+        int64_t wait_time = llround(hop * 1000.) - (current_time - last_time);
         last_time = current_time;
         if (wait_time > 0) sleep(wait_time);
     }
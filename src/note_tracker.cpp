@@ -0,0 +1,149 @@
+#include "note_tracker.h"
+
+#include "utils.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+
+NoteTracker::NoteTracker(size_t max_notes) {
+    // Notes being cut are still tracked while as many new ones start
+    capacity = max<size_t>(2 * max_notes, 1);
+    notes = (TrackedNote*) malloc(capacity * sizeof(TrackedNote));
+    nb_notes = 0;
+    next_id = 0;
+    min_duration = 0.;
+    min_cut = 0.;
+    on_threshold = 0.f;
+    off_threshold = 0.f;
+}
+
+
+NoteTracker::~NoteTracker() {
+    free(notes);
+}
+
+
+void NoteTracker::set_min_duration(double duration) {
+    min_duration = duration;
+}
+
+
+void NoteTracker::set_min_cut(double duration) {
+    min_cut = duration;
+}
+
+
+void NoteTracker::set_thresholds(float on, float off) {
+    on_threshold = on;
+    off_threshold = min(off, on);
+}
+
+
+// The last tracked note takes the place of the removed one
+void NoteTracker::remove(size_t index) {
+    notes[index] = notes[--nb_notes];
+}
+
+
+static inline float freq_ratio(float a, float b) {
+    return a > b ? a / b : b / a;
+}
+
+
+static inline void report(TrackedNote* note, NoteEventType type, double time, NoteEvent* event) {
+    event->type = type;
+    event->id = note->id;
+    event->freq = note->freq;
+    event->strength = note->strength;
+    event->time = time;
+    note->reported_freq = note->freq;
+    note->reported_strength = note->strength;
+}
+
+
+size_t NoteTracker::update(const Note* frame_notes, size_t nb_frame_notes, double time, NoteEvent* events) {
+    for (size_t i = 0; i < nb_notes; i++) notes[i].matched = false;
+
+    // Each note of the frame continues the closest tracked note not continued yet, or starts a new one
+    for (size_t f = 0; f < nb_frame_notes; f++) {
+        const Note& frame_note = frame_notes[f];
+        if (frame_note.freq <= 0.f) continue;
+
+        TrackedNote* closest = nullptr;
+        float closest_ratio = NOTE_TRACKER_MATCH_RATIO;
+        for (size_t i = 0; i < nb_notes; i++) {
+            if (notes[i].matched) continue;
+            const float ratio = freq_ratio(frame_note.freq, notes[i].freq);
+            if (ratio <= closest_ratio) {
+                closest = &notes[i];
+                closest_ratio = ratio;
+            }
+        }
+
+        // Hysteresis : an active note continues down to the off threshold, a note starts from the on one
+        const bool active = closest && closest->state == TRACKED_ACTIVE;
+        if (frame_note.strength < (active ? off_threshold : on_threshold)) continue;
+
+        if (!closest) {
+            if (nb_notes == capacity) continue;
+            closest = &notes[nb_notes++];
+            closest->state = TRACKED_PENDING;
+            closest->id = next_id++;
+            closest->start_time = time;
+        }
+
+        closest->matched = true;
+        closest->freq = frame_note.freq;
+        closest->strength = frame_note.strength;
+        closest->cut_time = -1.;
+    }
+
+    // Events of the tracked notes
+    size_t nb_events = 0;
+    for (size_t i = 0; i < nb_notes;) {
+        TrackedNote* note = &notes[i];
+
+        if (note->matched) {
+            if (note->state == TRACKED_PENDING) {
+                if (time - note->start_time >= min_duration) {
+                    note->state = TRACKED_ACTIVE;
+                    report(note, NOTE_START, note->start_time, &events[nb_events++]);
+                }
+            } else if (freq_ratio(note->freq, note->reported_freq) > NOTE_TRACKER_UPDATE_RATIO ||
+                       fabsf(note->strength - note->reported_strength) > NOTE_TRACKER_UPDATE_STRENGTH * note->reported_strength) {
+                report(note, NOTE_UPDATE, time, &events[nb_events++]);
+            }
+            i++;
+            continue;
+        }
+
+        // Missing notes : pending ones were too short, active ones end once the cut lasted long enough
+        if (note->state == TRACKED_PENDING) {
+            remove(i);
+            continue;
+        }
+        if (note->cut_time < 0.) note->cut_time = time;
+        if (time - note->cut_time >= min_cut) {
+            report(note, NOTE_END, note->cut_time, &events[nb_events++]);
+            remove(i);
+            continue;
+        }
+        i++;
+    }
+
+    return nb_events;
+}
+
+
+size_t NoteTracker::flush(double time, NoteEvent* events) {
+    size_t nb_events = 0;
+    for (size_t i = 0; i < nb_notes; i++) {
+        TrackedNote* note = &notes[i];
+        if (note->state == TRACKED_ACTIVE) {
+            report(note, NOTE_END, note->cut_time >= 0. ? note->cut_time : time, &events[nb_events++]);
+        }
+    }
+    nb_notes = 0;
+    return nb_events;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+// Follow the notes extracted frame after frame and only report their starts, changes and ends
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "interpretor.h"
+
+
+#define NOTE_TRACKER_MATCH_RATIO (1.029302236643492) // 2**(1/24) : a note of the next frame continues a note within half a semitone
+#define NOTE_TRACKER_UPDATE_RATIO (1.0145453349375237) // 2**(1/48) : smaller frequency changes aren't reported
+#define NOTE_TRACKER_UPDATE_STRENGTH (.25f) // Smaller relative strength changes aren't reported
+
+
+enum NoteEventType : uint8_t {
+    NOTE_START,
+    NOTE_UPDATE,
+    NOTE_END,
+};
+
+
+struct NoteEvent {
+    NoteEventType type;
+    uint32_t id; // Same id for all the events of a note
+    float freq;
+    float strength;
+    double time; // In seconds, the start of the note for NOTE_START and the time it was cut for NOTE_END
+};
+
+
+enum TrackedNoteState : uint8_t {
+    TRACKED_PENDING, // Seen for less than the minimum duration, not reported yet
+    TRACKED_ACTIVE,
+};
+
+
+struct TrackedNote {
+    TrackedNoteState state;
+    bool matched; // By a note of the current frame
+    uint32_t id;
+    float freq;
+    float strength;
+    float reported_freq; // Of the last event
+    float reported_strength;
+    double start_time;
+    double cut_time; // Time of the first frame without the note, negative while it is present
+};
+
+
+class NoteTracker {
+private:
+    TrackedNote* notes;
+    size_t capacity;
+    size_t nb_notes; // Tracked notes (the first ones of notes)
+    uint32_t next_id;
+
+    double min_duration;
+    double min_cut;
+    float on_threshold;
+    float off_threshold;
+
+    void remove(size_t index);
+
+public:
+    // max_notes is the maximum number of notes given at each frame
+    NoteTracker(size_t max_notes);
+    ~NoteTracker();
+
+    // Notes shorter than duration (in seconds) aren't reported, their start is reported once they lasted this long
+    void set_min_duration(double duration);
+
+    // Notes missing for less than duration (in seconds) continue
+    void set_min_cut(double duration);
+
+    // A note starts at on strength at least and continues down to off strength (hysteresis : off <= on)
+    void set_thresholds(float on, float off);
+
+    // Maximum number of events returned by a call to update() or flush()
+    inline size_t get_max_events() const { return capacity; }
+
+    // Follow the notes of the frame at time (in seconds, increasing from a call to the next one), write the events
+    // in events (get_max_events() at least) and return their number
+    // The work is proportional to the number of tracked notes times the number of notes of the frame
+    size_t update(const Note* frame_notes, size_t nb_frame_notes, double time, NoteEvent* events);
+
+    // End all the notes at time (end of the audio or jump), return the number of events
+    size_t flush(double time, NoteEvent* events);
+};
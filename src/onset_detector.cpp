@@ -0,0 +1,176 @@
+#include "onset_detector.h"
+
+#include "utils.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+OnsetDetector::OnsetDetector() {
+    nb_entries = 0;
+    memory = nullptr;
+    previous = nullptr;
+    current = nullptr;
+    middle = nullptr;
+    has_previous = false;
+    previous_time = 0.;
+    min_hop = 1. / 48.;
+    max_hop = 1. / 6.;
+    window_width = 1. / 8.;
+    sensitivity = 2.f;
+    hop = min_hop;
+    hold_until = 0.;
+    flux = 0.f;
+    onset_time = 0.;
+    nb_refine_analyses = 0;
+    fluxes.resize(1, ONSET_STATS_WINDOW);
+}
+
+
+OnsetDetector::~OnsetDetector() {
+    free(memory);
+}
+
+
+void OnsetDetector::set_hops(double min_hop, double max_hop) {
+    this->min_hop = min_hop;
+    this->max_hop = max(max_hop, min_hop);
+    hop = min(max(hop, this->min_hop), this->max_hop);
+}
+
+
+void OnsetDetector::set_window_width(double duration) {
+    window_width = duration;
+}
+
+
+void OnsetDetector::set_sensitivity(float sensitivity) {
+    this->sensitivity = sensitivity;
+}
+
+
+void OnsetDetector::reset() {
+    has_previous = false;
+    hop = min_hop;
+    hold_until = 0.;
+    flux = 0.f;
+    fluxes.clear();
+}
+
+
+void OnsetDetector::alloc(size_t nb_entries) {
+    this->nb_entries = nb_entries;
+    free(memory);
+    memory = (float*) malloc(3 * nb_entries * sizeof(float));
+    previous = memory;
+    current = &memory[nb_entries];
+    middle = &memory[2 * nb_entries];
+    reset();
+}
+
+
+static inline void copy_strengths(const Histogram& histogram, float* strengths) {
+    for (size_t i = 0; i < histogram.nb_entries; i++) strengths[i] = histogram.entries[i].value;
+}
+
+
+// Sum of the increases of the strengths (decays of held notes don't count)
+static inline float positive_change(const float* before, const float* after, size_t n) {
+    float sum = 0.f;
+    for (size_t i = 0; i < n; i++) sum += max(after[i] - before[i], 0.f);
+    return sum;
+}
+
+
+// Increases of the log strengths weighted by the current strengths : the flicker of held notes changes them by a few
+// percents while the notes of an onset rise from the noise
+static float log_flux(const float* before, const float* after, size_t n) {
+    float sum = 0.f;
+    for (size_t i = 0; i < n; i++) sum += after[i];
+    if (!(sum > 0.f)) return 0.f;
+
+    const float floor = sum / n * ONSET_NOISE_FLOOR;
+    float flux = 0.f;
+    for (size_t i = 0; i < n; i++) {
+        if (after[i] > before[i]) flux += after[i] * logf((after[i] + floor) / (before[i] + floor));
+    }
+    return flux / sum;
+}
+
+
+// The change between the previous frame and the current one happened somewhere in between : the interval is halved
+// toward the middle of the change until it is as short as the shortest hop
+void OnsetDetector::refine(Extractor* extractor, double* time) {
+    double low = previous_time;
+    double high = *time;
+    bool at_high = true; // The extractor is at high
+    while (high - low > min_hop) {
+        const double mid = (low + high) * .5;
+        extractor->jump(mid);
+        nb_refine_analyses++;
+        copy_strengths(extractor->histogram, middle);
+
+        if (positive_change(previous, middle, nb_entries) >= positive_change(middle, current, nb_entries)) {
+            high = mid;
+            float* t = current; current = middle; middle = t;
+            at_high = true;
+        } else {
+            low = mid;
+            float* t = previous; previous = middle; middle = t;
+            at_high = false;
+        }
+    }
+
+    if (!at_high) {
+        extractor->jump(high);
+        nb_refine_analyses++;
+    }
+    *time = high;
+}
+
+
+bool OnsetDetector::update(Extractor* extractor) {
+    const Histogram& histogram = extractor->histogram;
+    if (histogram.nb_entries != nb_entries) alloc(histogram.nb_entries);
+
+    double time = extractor->get_cursor();
+    copy_strengths(histogram, current);
+    if (!has_previous || time <= previous_time) {
+        float* t = previous; previous = current; current = t;
+        previous_time = time;
+        has_previous = true;
+        hop = min_hop;
+        return false;
+    }
+
+    flux = log_flux(previous, current, nb_entries);
+
+    // Above the usual level of the last frames
+    float threshold = ONSET_MIN_FLUX;
+    if (fluxes.get_count() > 0) {
+        threshold = max(threshold, fluxes.mean(0) + sensitivity * sqrtf(fluxes.variance(0)));
+    }
+    // The fluxes of the onsets would raise the threshold over the next ones
+    fluxes.push(0, min(flux, threshold));
+    fluxes.next_frame();
+
+    // The notes of an onset rise during a window width : one onset for them
+    const bool onset = flux > threshold && time >= hold_until;
+    if (onset && time - previous_time > min_hop * 1.5) refine(extractor, &time);
+
+    float* t = previous; previous = current; current = t;
+    previous_time = time;
+
+    // The hop starts over from the shortest one at each onset and grows while the notes are held : the next onset
+    // is often close after a short note, and the bisection locates the ones found after long hops
+    if (onset) {
+        onset_time = time + window_width * .5;
+        hold_until = time + window_width;
+        hop = min_hop;
+    } else {
+        hop = min(hop * ONSET_HOP_GROWTH, max_hop);
+    }
+
+    return onset;
+}
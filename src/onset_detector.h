@@ -0,0 +1,78 @@
+#pragma once
+
+// Detect note onsets from the spectral flux of consecutive histograms and adapt the hop of the analysis to them :
+// short hops after the onsets, long hops while the notes are held
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "extractor.h"
+#include "sliding_stats.h"
+
+
+#define ONSET_STATS_WINDOW 32 // Frames of the flux statistics the threshold adapts to
+#define ONSET_MIN_FLUX (.3f) // Smaller fluxes are never onsets
+#define ONSET_NOISE_FLOOR (.01f) // Relative to the mean strength, added to the strengths before their ratios
+#define ONSET_HOP_GROWTH (1.5) // Growth of the hop from a frame to the next one until the next onset
+
+
+class OnsetDetector {
+private:
+    size_t nb_entries;
+    float* memory; // One block for the strengths below
+    float* previous; // Strengths of the previous frame
+    float* current;
+    float* middle; // Strengths in the middle of an interval while an onset is refined
+
+    bool has_previous;
+    double previous_time;
+    double min_hop, max_hop;
+    double window_width; // Of the extractor, in seconds
+    float sensitivity;
+
+    double hop; // Until the next frame
+    double hold_until; // No other onset before this time
+    float flux; // Of the last frame
+    double onset_time;
+    uint64_t nb_refine_analyses;
+    SlidingStats fluxes;
+
+    void alloc(size_t nb_entries);
+    void refine(Extractor* extractor, double* time);
+
+public:
+    OnsetDetector();
+    ~OnsetDetector();
+
+    // Shortest and longest hops in seconds (the shortest one is the precision of the onsets)
+    void set_hops(double min_hop, double max_hop);
+
+    // Duration of the window of the extractor in seconds (a change takes this long to appear in the histogram)
+    void set_window_width(double duration);
+
+    // An onset is a flux above the mean of the last fluxes plus sensitivity times their standard deviation
+    void set_sensitivity(float sensitivity);
+
+    // Forget the previous frames (after a jump)
+    void reset();
+
+    // Analyze the histogram of the extractor at its cursor, before the interpretor changes it, return true for an onset
+    // An onset found after a hop longer than the shortest one is located by bisection : the extractor is moved back
+    // to the middle of the change (in get_nb_refine_analyses() more analyses), its histogram and cursor are then
+    // those of the onset
+    bool update(Extractor* extractor);
+
+    // Duration to forward the extractor by for the next frame
+    inline double get_hop() const { return hop; }
+
+    // Time of the last onset : the notes rise in the histogram as soon as they enter the window, half a window width
+    // before the cursor reaches them
+    inline double get_onset_time() const { return onset_time; }
+
+    // Increase of the log strengths since the previous frame, weighted by the current strengths
+    inline float get_flux() const { return flux; }
+
+    // Analyses of the extractor done to locate the onsets since the detector was created
+    inline uint64_t get_nb_refine_analyses() const { return nb_refine_analyses; }
+};
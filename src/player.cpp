@@ -38,11 +38,24 @@ Player::Player() {
 MusicPlayer::MusicPlayer() {
     cursor = 0;
     audio = nullptr;
+    prefetch_stop = false;
+}
+
+MusicPlayer::~MusicPlayer() {
+    stop_prefetch();
 }
 
 void MusicPlayer::play_audio(Audio* audio) {
+    // The prefetcher of a previous audio (played without stop()) reads this->audio
+    stop_prefetch();
     this->audio = audio;
 
+    // The first samples are available before the stream starts
+    const int64_t ahead = (int64_t) (MUSIC_PLAYER_PREFETCH * audio->rate);
+    audio->prefetch(cursor, cursor + ahead);
+    prefetch_stop = false;
+    prefetcher = std::thread(&MusicPlayer::prefetch_run, this);
+
     PaError err = Pa_OpenDefaultStream(
         &stream,
         0, /* no input channels */
@@ -80,6 +93,45 @@ void MusicPlayer::stop() {
     if (err != paNoError) {
         // TODO
     }
+
+    stop_prefetch();
+}
+
+
+void MusicPlayer::stop_prefetch() {
+    {
+        std::lock_guard<std::mutex> lock(prefetch_mutex);
+        prefetch_stop = true;
+    }
+    prefetch_cond.notify_all();
+    if (prefetcher.joinable()) prefetcher.join();
+}
+
+
+// Keep the samples ahead of the cursor available (loading them may wait for the disk or decode them)
+void MusicPlayer::prefetch_run() {
+    const int64_t ahead = (int64_t) (MUSIC_PLAYER_PREFETCH * audio->rate);
+    std::unique_lock<std::mutex> lock(prefetch_mutex);
+    while (!prefetch_stop) {
+        lock.unlock();
+        const int64_t start = cursor.load(std::memory_order_relaxed);
+        audio->prefetch(start, start + ahead);
+        lock.lock();
+        prefetch_cond.wait_for(lock, std::chrono::milliseconds(MUSIC_PLAYER_PREFETCH_PERIOD), [&]{ return prefetch_stop; });
+    }
+}
+
+
+// Interleave (and convert to float) frames of the audio
+template<typename T>
+static void write_frames(float* out, const Audio* audio, int64_t cursor, int64_t nb_frames) {
+    const int32_t nbchnls = audio->nb_channels;
+    for (int32_t i = 0; i < nbchnls; i++) {
+        const T* data = audio->get_data<T>(i);
+        for (int64_t j = 0; j < nb_frames; j++) {
+            out[j * nbchnls + i] = sample_to_float(data[j + cursor]);
+        }
+    }
 }
 
 
@@ -94,17 +146,24 @@ int MusicPlayer::pa_callback(
     if (!player->audio) return paAbort;
 
     float* const out = (float*) outputBuffer;
-    const size_t nbchnls = player->audio->nb_channels;
-    const size_t cursor = player->cursor;
+    const int64_t cursor = player->cursor.load(std::memory_order_relaxed);
 
-    for (size_t i = 0; i < nbchnls; i++) {
-        const float* data = player->audio->get_data(i);
-        for (size_t j = 0, m = min<size_t>(framesPerBuffer, player->audio->length - cursor); j < m; j++) {
-            out[j * nbchnls + i] = data[j + cursor];
-        }
+    // Nothing is loaded nor waited for here : samples not prefetched yet are played as silence
+    int64_t nb_frames = clamp<int64_t>(player->audio->length - cursor, 0, framesPerBuffer);
+    if (!player->audio->available(cursor, cursor + nb_frames)) nb_frames = 0;
+
+    if (player->audio->format == SAMPLE_FMT_INT16) {
+        write_frames<int16_t>(out, player->audio, cursor, nb_frames);
+    } else {
+        write_frames<float>(out, player->audio, cursor, nb_frames);
+    }
+
+    // Silence after the end of the audio (or while its samples are missing)
+    for (size_t i = nb_frames * player->audio->nb_channels, m = framesPerBuffer * player->audio->nb_channels; i < m; i++) {
+        out[i] = 0.f;
     }
 
-    player->cursor = cursor + framesPerBuffer;
+    player->cursor.store(cursor + framesPerBuffer, std::memory_order_relaxed);
 
     return paContinue;
 }
@@ -7,6 +7,15 @@
 
 #include "portaudio.h"
 
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+#define MUSIC_PLAYER_PREFETCH (.5) // Seconds of audio made available ahead of the played samples
+#define MUSIC_PLAYER_PREFETCH_PERIOD (10) // Milliseconds between two moves of the prefetched range
+
 
 class Player {
 protected:
@@ -21,7 +30,16 @@ public:
 class MusicPlayer : public Player {
 private:
     Audio* audio;
-    size_t cursor;
+    std::atomic<int64_t> cursor;
+
+    // The samples are loaded ahead of the cursor by this thread, the callback (real-time) only reads available ones
+    std::thread prefetcher;
+    std::mutex prefetch_mutex;
+    std::condition_variable prefetch_cond;
+    bool prefetch_stop;
+
+    void prefetch_run();
+    void stop_prefetch();
 
     static int pa_callback(
         const void *inputBuffer, void *outputBuffer,
@@ -33,6 +51,7 @@ private:
 
 public:
     MusicPlayer();
+    ~MusicPlayer();
 
     void play_audio(Audio* audio);
     void stop();
@@ -0,0 +1,141 @@
+#include "resampler.h"
+
+#include "audio.h"
+#include "simd.h"
+#include "utils.h"
+
+#include <numeric>
+
+
+Resampler::Resampler() {
+    up = 1;
+    down = 1;
+    nb_phases = 0;
+    nb_taps = 0;
+    filters = nullptr;
+}
+
+
+Resampler::~Resampler() {
+    aligned_free(filters);
+}
+
+
+// Modified Bessel function of the first kind of order 0 (for the Kaiser window)
+static double bessel_i0(double x) {
+    double sum = 1., term = 1.;
+    for (int k = 1; k < 50 && term > sum * 1e-12; k++) {
+        term *= (x / (2. * k)) * (x / (2. * k));
+        sum += term;
+    }
+    return sum;
+}
+
+
+// Each phase is a filter for one fractional position of the output frames between two input frames
+// Coefficient j of a phase multiplies the input frame floor(position) - nb_taps / 2 + 1 + j
+void Resampler::init(int32_t in_rate, int32_t out_rate) {
+    const int64_t g = std::gcd(in_rate, out_rate);
+    up = out_rate / g;
+    down = in_rate / g;
+
+    const int32_t tap_align = max<int32_t>(SIMD_FLOAT_LEN, 2);
+    const double ratio = min<double>(1., (double) up / (double) down);
+
+    if (up == down) {
+        // Same rate, the filter only copies the samples
+        nb_phases = 1;
+        nb_taps = tap_align;
+    } else {
+        nb_phases = (int32_t) min<int64_t>(up, RESAMPLER_MAX_PHASES);
+        nb_taps = (int32_t) align_up((size_t) ceil(RESAMPLER_TAPS / ratio), tap_align);
+    }
+
+    aligned_free(filters);
+    filters = (float*) aligned_malloc(nb_phases * nb_taps * sizeof(float), AUDIO_ALIGNMENT);
+
+    const double cutoff = RESAMPLER_CUTOFF * ratio; // Relative to the Nyquist frequency of the input
+    const double half = nb_taps / 2.;
+    const double i0_beta = bessel_i0(RESAMPLER_KAISER_BETA);
+
+    for (int32_t p = 0; p < nb_phases; p++) {
+        float* filter = &filters[p * nb_taps];
+        const double frac = (double) p / nb_phases;
+
+        if (up == down) {
+            for (int32_t j = 0; j < nb_taps; j++) filter[j] = 0.f;
+            filter[nb_taps / 2 - 1] = 1.f;
+            continue;
+        }
+
+        double sum = 0.;
+        for (int32_t j = 0; j < nb_taps; j++) {
+            const double t = (j - nb_taps / 2 + 1) - frac; // Distance to the output frame in input frames
+            const double x = t / half;
+            const double window = x * x < 1. ? bessel_i0(RESAMPLER_KAISER_BETA * sqrt(1. - x * x)) / i0_beta : 0.;
+            const double a = (double) PI * cutoff * t;
+            filter[j] = (float) (cutoff * (t == 0. ? 1. : sin(a) / a) * window);
+            sum += filter[j];
+        }
+
+        // Unit gain for every phase (no ripple at low frequencies)
+        for (int32_t j = 0; j < nb_taps; j++) filter[j] = (float) (filter[j] / sum);
+    }
+}
+
+
+int64_t Resampler::out_length(int64_t in_length) const {
+    return (in_length * up + down - 1) / down;
+}
+
+
+int64_t Resampler::in_start(int64_t start) const {
+    return start * down / up - nb_taps / 2 + 1;
+}
+
+
+int64_t Resampler::in_end(int64_t end) const {
+    // One more frame for the positions rounded to the next input frame
+    return (end - 1) * down / up + nb_taps / 2 + 2;
+}
+
+
+template<typename T>
+static inline T to_sample(const float v);
+
+template<>
+inline float to_sample(const float v) {
+    return v;
+}
+
+template<>
+inline int16_t to_sample(const float v) {
+    return (int16_t) lrintf(clamp<float>(v, -32768.f, 32767.f));
+}
+
+
+template<typename T>
+void Resampler::process(T* out, const T* in, int64_t start, int64_t count) const {
+    for (int64_t k = start; k < start + count; k++) {
+        const int64_t pos = k * down;
+        int64_t n = pos / up;
+        int64_t phase = ((pos % up) * nb_phases + up / 2) / up;
+        if (phase == nb_phases) {
+            phase = 0;
+            n++;
+        }
+
+        const float* filter = &filters[phase * nb_taps];
+        const T* x = &in[n - nb_taps / 2 + 1];
+
+        simd_float acc = simd_zero();
+        for (int32_t j = 0; j < nb_taps; j += SIMD_FLOAT_LEN)
+            acc = simd_fmadd(simd_load(&filter[j]), simd_loadu(&x[j]), acc);
+
+        out[k] = to_sample<T>(simd_hsum(acc));
+    }
+}
+
+
+template void Resampler::process<int16_t>(int16_t* out, const int16_t* in, int64_t start, int64_t count) const;
+template void Resampler::process<float>(float* out, const float* in, int64_t start, int64_t count) const;
@@ -0,0 +1,40 @@
+#pragma once
+
+// Polyphase windowed sinc resampler
+
+
+#include <stdint.h>
+
+
+#define RESAMPLER_TAPS 32 // Number of taps per output sample when upsampling (scaled by the decimation ratio otherwise)
+#define RESAMPLER_MAX_PHASES 1024 // Fractional positions are rounded to this many phases when the rate ratio is not simple
+#define RESAMPLER_CUTOFF (0.9f) // Cutoff frequency relative to the lowest Nyquist frequency
+#define RESAMPLER_KAISER_BETA (8.f)
+
+
+class Resampler {
+private:
+    int64_t up, down; // out_rate / in_rate = up / down
+    int32_t nb_phases;
+    int32_t nb_taps; // Multiple of SIMD_FLOAT_LEN
+    float* filters; // nb_phases filters of nb_taps coefficients
+
+public:
+    Resampler();
+    ~Resampler();
+
+    void init(int32_t in_rate, int32_t out_rate);
+
+    // Number of output frames for an input of in_length frames
+    int64_t out_length(int64_t in_length) const;
+
+    // Input frames read to compute the output frames from start to end (excluded)
+    // Up to nb_taps / 2 frames are read before 0 and after the input length
+    int64_t in_start(int64_t start) const;
+    int64_t in_end(int64_t end) const;
+    inline int32_t get_nb_taps() const { return nb_taps; }
+
+    // Compute output frames from start to start + count (in and out are indexed from the first frame of the audios)
+    template<typename T>
+    void process(T* out, const T* in, int64_t start, int64_t count) const;
+};
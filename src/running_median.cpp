@@ -0,0 +1,165 @@
+#include "running_median.h"
+
+#include <stdlib.h>
+
+
+RunningMedian::RunningMedian() {
+    nb_series = 0;
+    window = 1;
+    heap_capacity = 1;
+    frame = 0;
+    slot = 0;
+    memory = nullptr;
+    lows = nullptr;
+    highs = nullptr;
+    positions = nullptr;
+}
+
+
+RunningMedian::~RunningMedian() {
+    free(memory);
+}
+
+
+void RunningMedian::resize(size_t nb_series, size_t window) {
+    this->nb_series = nb_series;
+    this->window = window > 0 ? window : 1;
+    heap_capacity = (this->window + 1) / 2;
+
+    const size_t n = nb_series * heap_capacity;
+    free(memory);
+    memory = malloc(2 * n * sizeof(RunningMedianEntry) + nb_series * this->window * sizeof(int32_t));
+    lows = (RunningMedianEntry*) memory;
+    highs = &lows[n];
+    positions = (int32_t*) &highs[n];
+
+    clear();
+}
+
+
+void RunningMedian::clear() {
+    frame = 0;
+    slot = 0;
+}
+
+
+// Heaps of the lower halves are max-heaps, heaps of the upper halves are min-heaps
+template <bool LOW>
+static inline bool heap_before(const RunningMedianEntry& a, const RunningMedianEntry& b) {
+    return LOW ? a.value > b.value : a.value < b.value;
+}
+
+
+template <bool LOW>
+static inline void heap_set(RunningMedianEntry* heap, int32_t* pos, size_t i, const RunningMedianEntry& entry) {
+    heap[i] = entry;
+    pos[entry.slot] = LOW ? (int32_t) i : -1 - (int32_t) i;
+}
+
+
+// Sift an entry of a heap to its place, the positions of the moved entries are updated
+template <bool LOW>
+static void sift_up(RunningMedianEntry* heap, int32_t* pos, size_t i) {
+    const RunningMedianEntry entry = heap[i];
+    while (i > 0) {
+        const size_t parent = (i - 1) / 2;
+        if (!heap_before<LOW>(entry, heap[parent])) break;
+        heap_set<LOW>(heap, pos, i, heap[parent]);
+        i = parent;
+    }
+    heap_set<LOW>(heap, pos, i, entry);
+}
+
+
+template <bool LOW>
+static void sift_down(RunningMedianEntry* heap, int32_t* pos, size_t size, size_t i) {
+    const RunningMedianEntry entry = heap[i];
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= size) break;
+        if (child + 1 < size && heap_before<LOW>(heap[child + 1], heap[child])) child++;
+        if (!heap_before<LOW>(heap[child], entry)) break;
+        heap_set<LOW>(heap, pos, i, heap[child]);
+        i = child;
+    }
+    heap_set<LOW>(heap, pos, i, entry);
+}
+
+
+template <bool LOW>
+static inline void sift(RunningMedianEntry* heap, int32_t* pos, size_t size, size_t i) {
+    if (i > 0 && heap_before<LOW>(heap[i], heap[(i - 1) / 2])) sift_up<LOW>(heap, pos, i);
+    else sift_down<LOW>(heap, pos, size, i);
+}
+
+
+// The window isn't full : the heaps grow by one entry, the low one keeps the extra entry of an odd count
+void RunningMedian::insert(RunningMedianEntry* low, RunningMedianEntry* high, int32_t* pos, float value) {
+    const size_t count = get_count();
+    const size_t nb_lows = (count + 1) / 2;
+    const size_t nb_highs = count / 2;
+    RunningMedianEntry entry {value, slot};
+
+    if (nb_lows == nb_highs) {
+        // The low heap grows, with the lowest value of the high heap if the new one is above it
+        if (nb_highs > 0 && value > high[0].value) {
+            const RunningMedianEntry top = high[0];
+            heap_set<false>(high, pos, 0, entry);
+            sift_down<false>(high, pos, nb_highs, 0);
+            entry = top;
+        }
+        heap_set<true>(low, pos, nb_lows, entry);
+        sift_up<true>(low, pos, nb_lows);
+    } else {
+        if (value < low[0].value) {
+            const RunningMedianEntry top = low[0];
+            heap_set<true>(low, pos, 0, entry);
+            sift_down<true>(low, pos, nb_lows, 0);
+            entry = top;
+        }
+        heap_set<false>(high, pos, nb_highs, entry);
+        sift_up<false>(high, pos, nb_highs);
+    }
+}
+
+
+// The window is full : the value takes the place of the value leaving the window in its heap, then the tops of the
+// heaps are swapped if the halves don't split the values anymore
+void RunningMedian::replace(RunningMedianEntry* low, RunningMedianEntry* high, int32_t* pos, float value) {
+    const size_t nb_lows = (window + 1) / 2;
+    const size_t nb_highs = window / 2;
+    const int32_t p = pos[slot];
+
+    if (p >= 0) {
+        low[p].value = value;
+        sift<true>(low, pos, nb_lows, p);
+    } else {
+        high[-1 - p].value = value;
+        sift<false>(high, pos, nb_highs, -1 - p);
+    }
+
+    if (nb_highs > 0 && low[0].value > high[0].value) {
+        const RunningMedianEntry top = low[0];
+        heap_set<true>(low, pos, 0, high[0]);
+        heap_set<false>(high, pos, 0, top);
+        sift_down<true>(low, pos, nb_lows, 0);
+        sift_down<false>(high, pos, nb_highs, 0);
+    }
+}
+
+
+void RunningMedian::push(size_t series, float value) {
+    RunningMedianEntry* low = &lows[series * heap_capacity];
+    RunningMedianEntry* high = &highs[series * heap_capacity];
+    int32_t* pos = &positions[series * window];
+
+    if (frame < window) insert(low, high, pos, value);
+    else replace(low, high, pos, value);
+}
+
+
+float RunningMedian::median(size_t series) const {
+    const RunningMedianEntry* low = &lows[series * heap_capacity];
+    const RunningMedianEntry* high = &highs[series * heap_capacity];
+    return get_count() % 2 ? low[0].value : (low[0].value + high[0].value) * .5f;
+}
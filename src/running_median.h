@@ -0,0 +1,62 @@
+#pragma once
+
+// Medians of series of values over a sliding window of the last frames (one value per series per frame)
+// Each series keeps the lower half of its window in a max-heap and the upper half in a min-heap : the median is at
+// their tops and a value replaces the one leaving the window in O(log window)
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+struct RunningMedianEntry {
+    float value;
+    uint32_t slot; // Of the frame of the value
+};
+
+
+class RunningMedian {
+private:
+    size_t nb_series;
+    size_t window; // In frames
+    size_t heap_capacity; // Entries of each heap of a series
+    uint64_t frame; // Index of the frame being added
+    uint32_t slot; // Position of the frame being added in the window (frame modulo window)
+    void* memory; // One block for all the arrays
+
+    RunningMedianEntry* lows; // Max-heaps of the lower halves of the windows (heap_capacity entries per series)
+    RunningMedianEntry* highs; // Min-heaps of the upper halves
+    int32_t* positions; // Of the value of each slot of each series : index in its low heap, or -1 - index in its high heap
+
+    void insert(RunningMedianEntry* low, RunningMedianEntry* high, int32_t* pos, float value);
+    void replace(RunningMedianEntry* low, RunningMedianEntry* high, int32_t* pos, float value);
+
+public:
+    RunningMedian();
+    ~RunningMedian();
+
+    // Number of series and length of the window in frames (at least 1), the values are cleared
+    void resize(size_t nb_series, size_t window);
+
+    // Forget all the frames
+    void clear();
+
+    // Set the value of a series for the current frame (once per series and per frame), O(log window)
+    void push(size_t series, float value);
+
+    // End the current frame, the next pushed values belong to the next one
+    inline void next_frame() {
+        frame++;
+        slot = slot + 1 < window ? slot + 1 : 0;
+    }
+
+    inline size_t get_nb_series() const { return nb_series; }
+    inline size_t get_window() const { return window; }
+
+    // Number of frames in the window (only the frames ended by next_frame())
+    inline size_t get_count() const { return frame < window ? (size_t) frame : window; }
+
+    // Median of a series over the window, mean of the two middle values for an even count (not valid while the window
+    // has no frame)
+    float median(size_t series) const;
+};
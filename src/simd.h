@@ -0,0 +1,143 @@
+#pragma once
+
+// Small SIMD layer (the vector width is selected at compile time from the target flags)
+
+
+#include <stdint.h>
+
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+#define SIMD_FLOAT_LEN 8
+
+typedef __m256 simd_float;
+
+inline simd_float simd_zero() { return _mm256_setzero_ps(); }
+inline simd_float simd_set1(const float v) { return _mm256_set1_ps(v); }
+inline simd_float simd_loadu(const float* p) { return _mm256_loadu_ps(p); }
+inline simd_float simd_load(const float* p) { return _mm256_load_ps(p); }
+inline void simd_storeu(float* p, const simd_float v) { _mm256_storeu_ps(p, v); }
+inline void simd_store(float* p, const simd_float v) { _mm256_store_ps(p, v); }
+inline simd_float simd_add(const simd_float a, const simd_float b) { return _mm256_add_ps(a, b); }
+inline simd_float simd_sub(const simd_float a, const simd_float b) { return _mm256_sub_ps(a, b); }
+inline simd_float simd_mul(const simd_float a, const simd_float b) { return _mm256_mul_ps(a, b); }
+inline simd_float simd_min(const simd_float a, const simd_float b) { return _mm256_min_ps(a, b); }
+inline simd_float simd_max(const simd_float a, const simd_float b) { return _mm256_max_ps(a, b); }
+
+// Load int16 samples and widen them to float lanes
+inline simd_float simd_loadu(const int16_t* p) {
+    return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*) p)));
+}
+
+// Round float lanes to the nearest int16 samples with saturation and store them
+inline void simd_storeu(int16_t* p, const simd_float v) {
+    const __m256i x = _mm256_packs_epi32(_mm256_cvtps_epi32(v), _mm256_setzero_si256());
+    _mm_storeu_si128((__m128i*) p, _mm256_castsi256_si128(_mm256_permute4x64_epi64(x, _MM_SHUFFLE(3, 1, 2, 0))));
+}
+
+inline simd_float simd_fmadd(const simd_float a, const simd_float b, const simd_float c) {
+#ifdef __FMA__
+    return _mm256_fmadd_ps(a, b, c);
+#else
+    return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+}
+
+// Load the odd floats of 2 * SIMD_FLOAT_LEN floats (the second field of an array of pairs of floats)
+inline simd_float simd_loadu_odd(const float* p) {
+    const __m256 x = _mm256_shuffle_ps(_mm256_loadu_ps(p), _mm256_loadu_ps(p + 8), _MM_SHUFFLE(3, 1, 3, 1));
+    return _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(x), _MM_SHUFFLE(3, 1, 2, 0)));
+}
+
+// Bit i is set when lane i of a is greater (or equal) than lane i of b
+inline uint32_t simd_mask_greater(const simd_float a, const simd_float b) { return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_GT_OQ)); }
+inline uint32_t simd_mask_greater_equal(const simd_float a, const simd_float b) { return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_GE_OQ)); }
+
+inline float simd_hsum(const simd_float v) {
+    __m128 x = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+    x = _mm_add_ss(x, _mm_shuffle_ps(x, x, 1));
+    return _mm_cvtss_f32(x);
+}
+
+#elif defined(__SSE2__)
+
+#include <emmintrin.h>
+
+#define SIMD_FLOAT_LEN 4
+
+typedef __m128 simd_float;
+
+inline simd_float simd_zero() { return _mm_setzero_ps(); }
+inline simd_float simd_set1(const float v) { return _mm_set1_ps(v); }
+inline simd_float simd_loadu(const float* p) { return _mm_loadu_ps(p); }
+inline simd_float simd_load(const float* p) { return _mm_load_ps(p); }
+inline void simd_storeu(float* p, const simd_float v) { _mm_storeu_ps(p, v); }
+inline void simd_store(float* p, const simd_float v) { _mm_store_ps(p, v); }
+inline simd_float simd_add(const simd_float a, const simd_float b) { return _mm_add_ps(a, b); }
+inline simd_float simd_sub(const simd_float a, const simd_float b) { return _mm_sub_ps(a, b); }
+inline simd_float simd_mul(const simd_float a, const simd_float b) { return _mm_mul_ps(a, b); }
+inline simd_float simd_min(const simd_float a, const simd_float b) { return _mm_min_ps(a, b); }
+inline simd_float simd_max(const simd_float a, const simd_float b) { return _mm_max_ps(a, b); }
+
+// Load int16 samples and widen them to float lanes (sign extend by shifting, SSE2 has no cvtepi16)
+inline simd_float simd_loadu(const int16_t* p) {
+    const __m128i x = _mm_loadl_epi64((const __m128i*) p);
+    return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+}
+
+// Round float lanes to the nearest int16 samples with saturation and store them
+inline void simd_storeu(int16_t* p, const simd_float v) {
+    const __m128i x = _mm_cvtps_epi32(v);
+    _mm_storel_epi64((__m128i*) p, _mm_packs_epi32(x, x));
+}
+
+inline simd_float simd_fmadd(const simd_float a, const simd_float b, const simd_float c) {
+    return _mm_add_ps(_mm_mul_ps(a, b), c);
+}
+
+// Load the odd floats of 2 * SIMD_FLOAT_LEN floats (the second field of an array of pairs of floats)
+inline simd_float simd_loadu_odd(const float* p) {
+    return _mm_shuffle_ps(_mm_loadu_ps(p), _mm_loadu_ps(p + 4), _MM_SHUFFLE(3, 1, 3, 1));
+}
+
+// Bit i is set when lane i of a is greater (or equal) than lane i of b
+inline uint32_t simd_mask_greater(const simd_float a, const simd_float b) { return _mm_movemask_ps(_mm_cmpgt_ps(a, b)); }
+inline uint32_t simd_mask_greater_equal(const simd_float a, const simd_float b) { return _mm_movemask_ps(_mm_cmpge_ps(a, b)); }
+
+inline float simd_hsum(const simd_float v) {
+    __m128 x = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    x = _mm_add_ss(x, _mm_shuffle_ps(x, x, 1));
+    return _mm_cvtss_f32(x);
+}
+
+#else
+
+#include <math.h>
+
+#define SIMD_FLOAT_LEN 1
+
+typedef float simd_float;
+
+inline simd_float simd_zero() { return 0.f; }
+inline simd_float simd_set1(const float v) { return v; }
+inline simd_float simd_loadu(const float* p) { return *p; }
+inline simd_float simd_load(const float* p) { return *p; }
+inline void simd_storeu(float* p, const simd_float v) { *p = v; }
+inline void simd_store(float* p, const simd_float v) { *p = v; }
+inline simd_float simd_add(const simd_float a, const simd_float b) { return a + b; }
+inline simd_float simd_sub(const simd_float a, const simd_float b) { return a - b; }
+inline simd_float simd_mul(const simd_float a, const simd_float b) { return a * b; }
+inline simd_float simd_min(const simd_float a, const simd_float b) { return a > b ? b : a; }
+inline simd_float simd_max(const simd_float a, const simd_float b) { return a > b ? a : b; }
+inline simd_float simd_loadu(const int16_t* p) { return (float) *p; }
+inline void simd_storeu(int16_t* p, const simd_float v) { *p = (int16_t) lrintf(v > 32767.f ? 32767.f : (v < -32768.f ? -32768.f : v)); }
+inline simd_float simd_fmadd(const simd_float a, const simd_float b, const simd_float c) { return a * b + c; }
+inline simd_float simd_loadu_odd(const float* p) { return p[1]; }
+inline uint32_t simd_mask_greater(const simd_float a, const simd_float b) { return a > b; }
+inline uint32_t simd_mask_greater_equal(const simd_float a, const simd_float b) { return a >= b; }
+inline float simd_hsum(const simd_float v) { return v; }
+
+#endif
@@ -0,0 +1,164 @@
+#include "sliding_stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+SlidingStats::SlidingStats() {
+    nb_series = 0;
+    window = 1;
+    frame = 0;
+    slot = 0;
+    memory = nullptr;
+    values = nullptr;
+    min_queues = nullptr;
+    max_queues = nullptr;
+    min_heads = nullptr;
+    min_lens = nullptr;
+    max_heads = nullptr;
+    max_lens = nullptr;
+    sums = nullptr;
+    sums_sq = nullptr;
+}
+
+
+SlidingStats::~SlidingStats() {
+    free(memory);
+}
+
+
+void SlidingStats::resize(size_t nb_series, size_t window) {
+    this->nb_series = nb_series;
+    this->window = window > 0 ? window : 1;
+
+    // Largest elements first to keep them aligned
+    const size_t n = nb_series * this->window;
+    free(memory);
+    memory = malloc(2 * nb_series * sizeof(double) + 2 * n * sizeof(SlidingStatsEntry) + n * sizeof(float) + 4 * nb_series * sizeof(uint32_t));
+    sums = (double*) memory;
+    sums_sq = &sums[nb_series];
+    min_queues = (SlidingStatsEntry*) &sums_sq[nb_series];
+    max_queues = &min_queues[n];
+    values = (float*) &max_queues[n];
+    min_heads = (uint32_t*) &values[n];
+    min_lens = &min_heads[nb_series];
+    max_heads = &min_lens[nb_series];
+    max_lens = &max_heads[nb_series];
+
+    clear();
+}
+
+
+void SlidingStats::clear() {
+    frame = 0;
+    slot = 0;
+    memset(sums, 0, nb_series * sizeof(double));
+    memset(sums_sq, 0, nb_series * sizeof(double));
+    memset(min_heads, 0, 4 * nb_series * sizeof(uint32_t));
+}
+
+
+// Position of the i-th element of a queue starting at head (i < window)
+static inline uint32_t queue_pos(uint32_t head, uint32_t i, size_t window) {
+    const size_t pos = (size_t) head + i;
+    return (uint32_t) (pos < window ? pos : pos - window);
+}
+
+
+void SlidingStats::push(size_t series, float value) {
+    float* slot_value = &values[(size_t) slot * nb_series + series];
+    SlidingStatsEntry* min_queue = &min_queues[series * window];
+    SlidingStatsEntry* max_queue = &max_queues[series * window];
+
+    // The value of the frame leaving the window is replaced (in the same slot) and leaves the front of the queues
+    const double old = frame >= window ? *slot_value : 0.;
+    sums[series] += value - old;
+    sums_sq[series] += (double) value * value - old * old;
+    *slot_value = value;
+
+    if (frame >= window) {
+        if (min_lens[series] > 0 && min_queue[min_heads[series]].slot == slot) {
+            min_heads[series] = queue_pos(min_heads[series], 1, window);
+            min_lens[series]--;
+        }
+        if (max_lens[series] > 0 && max_queue[max_heads[series]].slot == slot) {
+            max_heads[series] = queue_pos(max_heads[series], 1, window);
+            max_lens[series]--;
+        }
+    }
+
+    // Values that can't be the minimum (or maximum) anymore are dropped from the back of the queues
+    const uint32_t min_head = min_heads[series];
+    uint32_t len = min_lens[series];
+    while (len > 0 && min_queue[queue_pos(min_head, len - 1, window)].value >= value) len--;
+    min_queue[queue_pos(min_head, len, window)] = SlidingStatsEntry {slot, value};
+    min_lens[series] = len + 1;
+
+    const uint32_t max_head = max_heads[series];
+    len = max_lens[series];
+    while (len > 0 && max_queue[queue_pos(max_head, len - 1, window)].value <= value) len--;
+    max_queue[queue_pos(max_head, len, window)] = SlidingStatsEntry {slot, value};
+    max_lens[series] = len + 1;
+}
+
+
+float SlidingStats::mean(size_t series) const {
+    return (float) (sums[series] / get_count());
+}
+
+
+float SlidingStats::variance(size_t series) const {
+    const double m = sums[series] / get_count();
+    const double v = sums_sq[series] / get_count() - m * m;
+    return v > 0. ? (float) v : 0.f; // Rounding errors of the running sums
+}
+
+
+float SlidingStats::min(size_t series) const {
+    return min_queues[series * window + min_heads[series]].value;
+}
+
+
+float SlidingStats::max(size_t series) const {
+    return max_queues[series * window + max_heads[series]].value;
+}
+
+
+float SlidingStats::mean() const {
+    double sum = 0.;
+    for (size_t s = 0; s < nb_series; s++) sum += sums[s];
+    return (float) (sum / ((double) get_count() * nb_series));
+}
+
+
+float SlidingStats::variance() const {
+    double sum = 0., sum_sq = 0.;
+    for (size_t s = 0; s < nb_series; s++) {
+        sum += sums[s];
+        sum_sq += sums_sq[s];
+    }
+    const double n = (double) get_count() * nb_series;
+    const double m = sum / n;
+    const double v = sum_sq / n - m * m;
+    return v > 0. ? (float) v : 0.f;
+}
+
+
+float SlidingStats::min() const {
+    float x = min(0);
+    for (size_t s = 1; s < nb_series; s++) {
+        const float v = min(s);
+        if (v < x) x = v;
+    }
+    return x;
+}
+
+
+float SlidingStats::max() const {
+    float x = max(0);
+    for (size_t s = 1; s < nb_series; s++) {
+        const float v = max(s);
+        if (v > x) x = v;
+    }
+    return x;
+}
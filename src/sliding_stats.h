@@ -0,0 +1,73 @@
+#pragma once
+
+// Statistics of series of values over a sliding window of the last frames (one value per series per frame)
+// Adding a frame costs O(1) per series whatever the length of the window : sums are updated by the values entering
+// and leaving the window, minimums and maximums are the fronts of monotonic queues
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+struct SlidingStatsEntry {
+    uint32_t slot; // Of the frame of the value
+    float value;
+};
+
+
+class SlidingStats {
+private:
+    size_t nb_series;
+    size_t window; // In frames
+    uint64_t frame; // Index of the frame being added
+    uint32_t slot; // Position of the frame being added in the rings (frame modulo window)
+    void* memory; // One block for all the arrays
+
+    float* values; // Values of the last frames (ring of window frames of nb_series values)
+    SlidingStatsEntry* min_queues; // Values of each series that can become its minimum (increasing values, rings of window entries)
+    SlidingStatsEntry* max_queues; // Same for the maximum (decreasing values)
+    uint32_t* min_heads; // First element of the queue of each series in its ring
+    uint32_t* min_lens;
+    uint32_t* max_heads;
+    uint32_t* max_lens;
+    double* sums; // Sums of the values of each series in the window
+    double* sums_sq; // Sums of their squares
+
+public:
+    SlidingStats();
+    ~SlidingStats();
+
+    // Number of series and length of the window in frames (at least 1), the statistics are cleared
+    void resize(size_t nb_series, size_t window);
+
+    // Forget all the frames
+    void clear();
+
+    // Set the value of a series for the current frame (once per series and per frame)
+    void push(size_t series, float value);
+
+    // End the current frame, the next pushed values belong to the next one
+    inline void next_frame() {
+        frame++;
+        slot = slot + 1 < window ? slot + 1 : 0;
+    }
+
+    inline size_t get_nb_series() const { return nb_series; }
+    inline size_t get_window() const { return window; }
+
+    // Number of frames in the window (only the frames ended by next_frame())
+    inline size_t get_count() const { return frame < window ? (size_t) frame : window; }
+
+    // Statistics of a series over the window (not valid while the window has no frame)
+    float mean(size_t series) const;
+    float variance(size_t series) const;
+    float min(size_t series) const;
+    float max(size_t series) const;
+
+    // Statistics of all the values of all the series over the window (O(number of series) : the statistics of the
+    // series are combined)
+    float mean() const;
+    float variance() const;
+    float min() const;
+    float max() const;
+};
@@ -1,68 +1,158 @@
 #pragma once
 
-// Very fast sort function (theorically faster than basic merge sort, quicksort or timsort)
-// Complexity (I guess) :
-//   Mininum : O(n)
+// Stable sort function : bottom up merge sort skipping the parts already in order
+// Complexity :
+//   Mininum : O(n) (sorted data)
 //   Average : O(n log n)
 //   Maximum : O(n log n)
+// Numbers and types with a sort_key() are radix sorted instead : O(n) with one pass per byte of the key
+// (no type of the program has a sort_key() : the histograms are no longer sorted since extract_notes and keep_harmony
+// select their entries, this path is kept for the library and exercised by research/sort-bench.cpp)
+// (short arrays with a key of 32 bits at most are sorted by a SIMD bitonic network with AVX2 : O(n log² n) without branch)
+// Elements are compared by a const operator> (the merges compare elements through const references)
+// See research/sort-bench.cpp for measures against the standard sorts
 
 
 #include <stdint.h>
+#include <string.h>
+#include <type_traits>
 
+#include "thread_pool.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+
+#define SORT_RADIX_MIN_LENGTH 256 // Shorter arrays are merge sorted (the radix passes cost more than they save)
+#define SORT_RUN_LENGTH 16 // Elements sorted by insertion before the merges (merging short parts costs more)
+#define SORT_NETWORK_MIN_LENGTH 32 // Arrays with a key of 32 bits at most are sorted by SIMD networks from this length
+#define SORT_NETWORK_MAX_LENGTH 256 // up to this one (AVX2 only), longer ones are radix sorted instead of sorted by blocks
+#define SORT_PARALLEL_MIN_LENGTH (1 << 16) // Shorter arrays are sorted by one thread (waking the workers costs more)
+#define SORT_PARALLEL_PARTS_PER_THREAD 4 // Parts of each round of parallel merges per thread (balances the threads)
+
+
+// Stable insertion sort of data[start, end) (for the short runs merged next)
 template<typename T>
-inline void _merge_swap(T* a, T* b) {
-    T x = *a;
-    *a = *b;
-    *b = x;
+static inline void _insertion_sort(T* data, size_t start, size_t end) {
+    for (size_t i = start + 1; i < end; i++) {
+        if (!(data[i - 1] > data[i])) continue;
+        const T x = data[i];
+        size_t j = i;
+        do {
+            data[j] = data[j - 1];
+            j--;
+        } while (j > start && data[j - 1] > x);
+        data[j] = x;
+    }
 }
 
 
-// Can be optimized by doing a dichotomie search to find where data
-// of the second part begin to be greater inside the first part
-template<typename T>
-static void _merge(T* data, T* buff, size_t start, size_t mid, size_t end) {
-    // Return directly if no merge is needed (this is the slight improve over the normal merge sort)
-    if (!(data[mid - 1] > data[mid])) return;
-
-    // Merge until one part is processed
-    size_t i = start, j = mid, s = 0, e = 0;
-    for (; i < mid && j < end; i++) {
-        if (s < e) {
-            buff[e++] = data[i];
-            if (buff[s] > data[j]) {
-                data[i] = data[j++];
-            } else {
-                data[i] = buff[s++];
-            }
-        } else {
-            if (data[i] > data[j]) {
-                buff[e++] = data[i];
-                data[i] = data[j++];
-            }
+// First position of the sorted data[start, end) where pred is true (pred is false then true along the range)
+// Galloping : steps doubling from start then a binary search, O(log d) for an answer at a distance d of start
+template<typename T, typename P>
+static inline size_t _gallop_forward(const T* data, size_t start, size_t end, P pred) {
+    size_t lo = start, hi = end, step = 1;
+    while (lo < end) {
+        const size_t probe = end - lo > step ? lo + step - 1 : end - 1;
+        if (pred(data[probe])) {
+            hi = probe;
+            break;
         }
+        lo = probe + 1;
+        step *= 2;
+    }
+    while (lo < hi) {
+        const size_t m = lo + (hi - lo) / 2;
+        if (pred(data[m])) hi = m;
+        else lo = m + 1;
     }
+    return lo;
+}
+
 
-    // If i not reached the mid then there still elements in the first part to offset to the end
-    if (i < mid) {
-        for (size_t k = end, l = mid; l > i; ) {
-            data[--k] = data[--l];
+// Same galloping from end, O(log d) for an answer at a distance d of end
+template<typename T, typename P>
+static inline size_t _gallop_backward(const T* data, size_t start, size_t end, P pred) {
+    size_t lo = start, hi = end, step = 1;
+    while (hi > start) {
+        const size_t probe = hi - start > step ? hi - step : start;
+        if (!pred(data[probe])) {
+            lo = probe + 1;
+            break;
         }
+        hi = probe;
+        step *= 2;
     }
+    while (lo < hi) {
+        const size_t m = lo + (hi - lo) / 2;
+        if (pred(data[m])) hi = m;
+        else lo = m + 1;
+    }
+    return lo;
+}
 
-    // Keep until buffer is empty (so all remaining elements are already nice placed)
-    // or until j reached the end (so all remaining elements in the buffer must be placed at the end)
-    for (; s < e && j < end; i++) {
-        if (buff[s] > data[j]) {
-            data[i] = data[j++];
+
+// Merge the sorted parts data[start, mid) and data[mid, end) (stable, buff gets the smallest part)
+template<typename T>
+static void _merge(T* data, T* buff, size_t start, size_t mid, size_t end) {
+    // Return directly if no merge is needed (this is the slight improve over the normal merge sort)
+    if (mid >= end || !(data[mid - 1] > data[mid])) return;
+
+    // Elements of the first part up to the first of the second part and elements of the second part
+    // from the last of the first part are already in place, they are found by galloping from the middle
+    const T first_right = data[mid];
+    const T last_left = data[mid - 1];
+    start = _gallop_backward(data, start, mid, [&](const T& x) { return x > first_right; });
+    end = _gallop_forward(data, mid, end, [&](const T& x) { return !(last_left > x); });
+
+    // The whole first part goes after the second one (reversed data) : move the parts without comparing them
+    if (data[start] > data[end - 1]) {
+        if (mid - start <= end - mid) {
+            const size_t n = mid - start;
+            for (size_t i = 0; i < n; i++) buff[i] = data[start + i];
+            for (size_t i = mid; i < end; i++) data[i - n] = data[i];
+            for (size_t i = 0; i < n; i++) data[end - n + i] = buff[i];
         } else {
-            data[i] = buff[s++];
+            const size_t n = end - mid;
+            for (size_t i = 0; i < n; i++) buff[i] = data[mid + i];
+            for (size_t i = mid; i-- > start;) data[i + n] = data[i];
+            for (size_t i = 0; i < n; i++) data[start + i] = buff[i];
         }
+        return;
     }
 
-    // j reached the end so everything inside the buffer is greater (so can be placed at end)
-    while (s < e) {
-        data[i++] = buff[s++];
+    // Now every element of a part is on the wrong side of one element of the other part : the last element of
+    // the first part is merged last and the first one of the second part first, so the loops only check one part
+    // Elements are chosen by selecting their address (no branch to mispredict)
+    if (mid - start <= end - mid) {
+        const size_t n = mid - start;
+        for (size_t i = 0; i < n; i++) buff[i] = data[start + i];
+
+        const T* a = buff;
+        const T* b = &data[mid];
+        const T* const b_end = &data[end];
+        T* out = &data[start];
+        while (b < b_end) {
+            const bool take_b = *a > *b;
+            *out++ = *(take_b ? b : a);
+            b += take_b;
+            a += !take_b;
+        }
+        for (const T* const a_end = &buff[n]; a < a_end;) *out++ = *a++;
+    } else {
+        const size_t n = end - mid;
+        for (size_t i = 0; i < n; i++) buff[i] = data[mid + i];
+
+        // Merged backward from the end
+        size_t i = mid, j = n, k = end;
+        while (i > start) {
+            const bool take_a = data[i - 1] > buff[j - 1];
+            data[--k] = *(take_a ? &data[i - 1] : &buff[j - 1]);
+            i -= take_a;
+            j -= !take_a;
+        }
+        while (j > 0) data[--k] = buff[--j];
     }
 }
 
@@ -88,30 +178,408 @@ static size_t _merge_segments(T* data, T* buff, size_t length, size_t segment, s
 }
 
 
-// Iterative in place and slightly improved merge sort
+// Key of the radix sort : a number, or the result of sort_key() which must be ordered like operator>
+// (a float or an integer, the greatest elements are placed last)
 template<typename T>
-void sort(T* data, size_t length) {
-    // Swap elements two by two
-    for (size_t i = 0, m = length - 1; i < m; i += 2) {
-        if (data[i] > data[i + 1])
-            _merge_swap<T>(&data[i], &data[i + 1]);
+inline auto _sort_key(const T& v) {
+    if constexpr (std::is_arithmetic_v<T>) return v;
+    else return v.sort_key();
+}
+
+template<typename K>
+concept _radix_key_type = std::is_floating_point_v<K> || (std::is_integral_v<K> && !std::is_same_v<K, bool>);
+
+template<typename T>
+concept _radix_sortable = _radix_key_type<T> || requires(const T& v) {
+    { v.sort_key() } -> _radix_key_type;
+};
+
+
+// Unsigned integer with the same order as the key (floats with their sign bit flipped, negative ones all flipped)
+template<typename K>
+inline auto _radix_bits(K key) {
+    if constexpr (std::is_floating_point_v<K>) {
+        using U = std::conditional_t<sizeof(K) == 8, uint64_t, uint32_t>;
+        const U sign = (U) 1 << (sizeof(U) * 8 - 1);
+        if (key == 0) key = 0; // -0 and +0 are equal
+        U bits;
+        memcpy(&bits, &key, sizeof(bits));
+        return (bits & sign) ? (U) ~bits : (U) (bits | sign);
+    } else if constexpr (std::is_signed_v<K>) {
+        using U = std::make_unsigned_t<K>;
+        return (U) ((U) key ^ ((U) 1 << (sizeof(U) * 8 - 1)));
+    } else {
+        return key;
+    }
+}
+
+
+// Stable LSD radix sort by bytes of the keys, going back and forth between data and buff
+// Bytes equal for all the elements are skipped
+template<typename T>
+static void _radix_sort(T* data, size_t length, T* buff) {
+    using U = decltype(_radix_bits(_sort_key(data[0])));
+    constexpr int nb_bytes = sizeof(U);
+
+    size_t counts[nb_bytes][256] = {};
+    for (size_t i = 0; i < length; i++) {
+        const U bits = _radix_bits(_sort_key(data[i]));
+        for (int b = 0; b < nb_bytes; b++) counts[b][(bits >> (8 * b)) & 0xFF]++;
+    }
+
+    T* from = data;
+    T* to = buff;
+    const U first_bits = _radix_bits(_sort_key(data[0]));
+    for (int b = 0; b < nb_bytes; b++) {
+        size_t* count = counts[b];
+        if (count[(first_bits >> (8 * b)) & 0xFF] == length) continue;
+
+        size_t offset = 0;
+        for (int d = 0; d < 256; d++) {
+            const size_t c = count[d];
+            count[d] = offset;
+            offset += c;
+        }
+
+        for (size_t i = 0; i < length; i++) {
+            const U bits = _radix_bits(_sort_key(from[i]));
+            to[count[(bits >> (8 * b)) & 0xFF]++] = from[i];
+        }
+
+        T* x = from;
+        from = to;
+        to = x;
     }
 
-    if (length < 3) return;
+    if (from != data) {
+        for (size_t i = 0; i < length; i++) data[i] = from[i];
+    }
+}
 
-    const size_t stack_buff_len = 128 / sizeof(T);
 
-    // Allocate on heap and one stack buffer
-    T* heap_buff = length > stack_buff_len ? new T[length] : nullptr;
-    T stack_buff[stack_buff_len];
+#if defined(__AVX2__)
 
-    // Iterative merge sort
-    size_t segment = 2;
-    size_t remaining = length & 0x1;
+// Bitonic sorting network on registers of 4 keys of 64 bits : the key of an element in the high half and its position
+// in the low half (equal keys keep their order), with the sign bit flipped for the signed comparisons of AVX2
+// Every comparison of a stage is independent of the others : the network runs at the throughput of the CPU
+
+// Order the lanes of a and b two by two (a gets the smallest)
+static inline void _network_minmax(__m256i& a, __m256i& b) {
+    const __m256i gt = _mm256_cmpgt_epi64(a, b);
+    const __m256i lo = _mm256_blendv_epi8(a, b, gt);
+    b = _mm256_blendv_epi8(b, a, gt);
+    a = lo;
+}
+
+// Sort the lanes of a bitonic register
+static inline __m256i _network_clean(__m256i a) {
+    __m256i b = _mm256_permute4x64_epi64(a, _MM_SHUFFLE(1, 0, 3, 2));
+    _network_minmax(a, b);
+    a = _mm256_blend_epi32(a, b, 0xF0);
+    b = _mm256_permute4x64_epi64(a, _MM_SHUFFLE(2, 3, 0, 1));
+    _network_minmax(a, b);
+    return _mm256_blend_epi32(a, b, 0xCC);
+}
+
+static inline __m256i _network_reverse(__m256i a) {
+    return _mm256_permute4x64_epi64(a, _MM_SHUFFLE(0, 1, 2, 3));
+}
+
+// Sort 16 bitonic keys held by 4 registers
+static inline void _network_clean16(__m256i& r0, __m256i& r1, __m256i& r2, __m256i& r3) {
+    _network_minmax(r0, r2);
+    _network_minmax(r1, r3);
+    _network_minmax(r0, r1);
+    _network_minmax(r2, r3);
+    r0 = _network_clean(r0);
+    r1 = _network_clean(r1);
+    r2 = _network_clean(r2);
+    r3 = _network_clean(r3);
+}
+
+// Sort 16 keys : columns of the 4 registers, transposed into 4 sorted registers, merged by 2 then by 4
+static inline void _network_sort16(int64_t* keys) {
+    __m256i r0 = _mm256_loadu_si256((const __m256i*) &keys[0]);
+    __m256i r1 = _mm256_loadu_si256((const __m256i*) &keys[4]);
+    __m256i r2 = _mm256_loadu_si256((const __m256i*) &keys[8]);
+    __m256i r3 = _mm256_loadu_si256((const __m256i*) &keys[12]);
+
+    _network_minmax(r0, r1);
+    _network_minmax(r2, r3);
+    _network_minmax(r0, r2);
+    _network_minmax(r1, r3);
+    _network_minmax(r1, r2);
+
+    const __m256i t0 = _mm256_unpacklo_epi64(r0, r1);
+    const __m256i t1 = _mm256_unpackhi_epi64(r0, r1);
+    const __m256i t2 = _mm256_unpacklo_epi64(r2, r3);
+    const __m256i t3 = _mm256_unpackhi_epi64(r2, r3);
+    r0 = _mm256_permute2x128_si256(t0, t2, 0x20);
+    r1 = _mm256_permute2x128_si256(t1, t3, 0x20);
+    r2 = _mm256_permute2x128_si256(t0, t2, 0x31);
+    r3 = _mm256_permute2x128_si256(t1, t3, 0x31);
+
+    r1 = _network_reverse(r1);
+    r3 = _network_reverse(r3);
+    _network_minmax(r0, r1);
+    _network_minmax(r2, r3);
+    r0 = _network_clean(r0);
+    r1 = _network_clean(r1);
+    r2 = _network_clean(r2);
+    r3 = _network_clean(r3);
+
+    // The second half reversed makes the 16 keys bitonic
+    const __m256i r2r = _network_reverse(r3);
+    r3 = _network_reverse(r2);
+    r2 = r2r;
+    _network_clean16(r0, r1, r2, r3);
+
+    _mm256_storeu_si256((__m256i*) &keys[0], r0);
+    _mm256_storeu_si256((__m256i*) &keys[4], r1);
+    _mm256_storeu_si256((__m256i*) &keys[8], r2);
+    _mm256_storeu_si256((__m256i*) &keys[12], r3);
+}
+
+// Sort the keys (length is a multiple of 16) : blocks of 16 sorted then merged by bitonic merges
+// The network sorts a power of 2 of keys as if the missing ones were greater than all the others : they would stay
+// at the end, so the comparisons with them are skipped
+static void _network_sort_keys(int64_t* keys, size_t length) {
+    for (size_t i = 0; i < length; i += 16) _network_sort16(&keys[i]);
+
+    for (size_t size = 32; size < 2 * length; size *= 2) {
+        // Each key of the first half of a block against its mirror in the second half : both halves become bitonic
+        for (size_t block = 0; block < length; block += size) {
+            for (size_t i = block + size > length ? block + size - length : 0; i < size / 2; i += 4) {
+                __m256i a = _mm256_loadu_si256((const __m256i*) &keys[block + i]);
+                __m256i b = _network_reverse(_mm256_loadu_si256((const __m256i*) &keys[block + size - 4 - i]));
+                _network_minmax(a, b);
+                _mm256_storeu_si256((__m256i*) &keys[block + i], a);
+                _mm256_storeu_si256((__m256i*) &keys[block + size - 4 - i], _network_reverse(b));
+            }
+        }
+
+        for (size_t dist = size / 4; dist >= 16; dist /= 2) {
+            for (size_t block = 0; block < length; block += 2 * dist) {
+                for (size_t i = block; i < block + dist && i + dist < length; i += 4) {
+                    __m256i a = _mm256_loadu_si256((const __m256i*) &keys[i]);
+                    __m256i b = _mm256_loadu_si256((const __m256i*) &keys[i + dist]);
+                    _network_minmax(a, b);
+                    _mm256_storeu_si256((__m256i*) &keys[i], a);
+                    _mm256_storeu_si256((__m256i*) &keys[i + dist], b);
+                }
+            }
+        }
+
+        for (size_t i = 0; i < length; i += 16) {
+            __m256i r0 = _mm256_loadu_si256((const __m256i*) &keys[i]);
+            __m256i r1 = _mm256_loadu_si256((const __m256i*) &keys[i + 4]);
+            __m256i r2 = _mm256_loadu_si256((const __m256i*) &keys[i + 8]);
+            __m256i r3 = _mm256_loadu_si256((const __m256i*) &keys[i + 12]);
+            _network_clean16(r0, r1, r2, r3);
+            _mm256_storeu_si256((__m256i*) &keys[i], r0);
+            _mm256_storeu_si256((__m256i*) &keys[i + 4], r1);
+            _mm256_storeu_si256((__m256i*) &keys[i + 8], r2);
+            _mm256_storeu_si256((__m256i*) &keys[i + 12], r3);
+        }
+    }
+}
+
+
+// Sort the keys and the positions of the elements, then move the elements to their positions
+// The whole array is one network (its blocks of 16 are joined by bitonic merges, not merged like the merge sort) :
+// longer networks were no faster than the radix sort (research/sort-bench.cpp at 1024 and 4096 elements)
+template<typename T>
+static void _network_sort(T* data, size_t length, T* buff) {
+    constexpr int64_t sign = INT64_MIN;
+    int64_t keys[SORT_NETWORK_MAX_LENGTH];
+
+    // Padded up to a multiple of 16 with keys greater than all the others
+    const size_t padded = (length + 15) & ~(size_t) 15;
+    for (size_t i = 0; i < length; i++) {
+        keys[i] = (int64_t) ((uint64_t) _radix_bits(_sort_key(data[i])) << 32 | i) ^ sign;
+    }
+    for (size_t i = length; i < padded; i++) keys[i] = INT64_MAX;
+
+    _network_sort_keys(keys, padded);
+
+    for (size_t i = 0; i < length; i++) buff[i] = data[(uint32_t) keys[i]];
+    for (size_t i = 0; i < length; i++) data[i] = buff[i];
+}
+
+#endif
+
+
+// Iterative in place and slightly improved merge sort
+// buff is a scratch buffer of at least length elements, nothing is allocated
+template<typename T>
+void sort(T* data, size_t length, T* buff) {
+    if (length < 2) return;
+
+    if constexpr (_radix_sortable<T>) {
+#if defined(__AVX2__)
+        if constexpr (sizeof(_radix_bits(_sort_key(data[0]))) <= 4) {
+            if (length >= SORT_NETWORK_MIN_LENGTH && length <= SORT_NETWORK_MAX_LENGTH) {
+                _network_sort<T>(data, length, buff);
+                return;
+            }
+        }
+#endif
+        if (length >= SORT_RADIX_MIN_LENGTH) {
+            _radix_sort<T>(data, length, buff);
+            return;
+        }
+    }
+
+    // Sort the elements by runs
+    for (size_t i = 0; i < length; i += SORT_RUN_LENGTH) {
+        _insertion_sort<T>(data, i, length - i > SORT_RUN_LENGTH ? i + SORT_RUN_LENGTH : length);
+    }
+
+    if (length <= SORT_RUN_LENGTH) return;
+
+    // Iterative merge sort of the runs
+    size_t segment = SORT_RUN_LENGTH;
+    size_t remaining = length % SORT_RUN_LENGTH;
     for (; segment < length; segment *= 2) {
-        T* buff = segment <= stack_buff_len ? stack_buff : heap_buff; // The the right buffer for speed
         remaining = _merge_segments<T>(data, buff, length, segment, remaining);
     }
+}
+
+
+// Same with a scratch buffer on the stack for small arrays and on the heap otherwise
+template<typename T>
+void sort(T* data, size_t length) {
+    constexpr size_t stack_buff_len = 128 / sizeof(T) > 0 ? 128 / sizeof(T) : 1;
+
+    if (length <= stack_buff_len) {
+        T stack_buff[stack_buff_len];
+        sort<T>(data, length, stack_buff);
+        return;
+    }
 
-    if (heap_buff) delete[] heap_buff;
+    T* heap_buff = new T[length];
+    sort<T>(data, length, heap_buff);
+    delete[] heap_buff;
+}
+
+
+// Position in a[0, na) where the merge of a and b is cut to produce its first diag elements : they are a[0, i)
+// and b[0, diag - i) (merge path found by a binary search along the diagonal, equal elements of a go first)
+template<typename T>
+static inline size_t _merge_path(const T* a, size_t na, const T* b, size_t nb, size_t diag) {
+    size_t lo = diag > nb ? diag - nb : 0;
+    size_t hi = diag < na ? diag : na;
+    while (lo < hi) {
+        const size_t m = lo + (hi - lo) / 2;
+        if (a[m] > b[diag - m - 1]) hi = m;
+        else lo = m + 1;
+    }
+    return lo;
+}
+
+
+// Merge the sorted a[0, na) and b[0, nb) into out (stable)
+template<typename T>
+static inline void _merge_into(const T* a, size_t na, const T* b, size_t nb, T* out) {
+    const T* const a_end = a + na;
+    const T* const b_end = b + nb;
+    while (a < a_end && b < b_end) {
+        const bool take_b = *a > *b;
+        *out++ = *(take_b ? b : a);
+        b += take_b;
+        a += !take_b;
+    }
+    while (a < a_end) *out++ = *a++;
+    while (b < b_end) *out++ = *b++;
+}
+
+
+// Same stable sort on the threads of a pool : segments sorted by sort() on each thread then merged two by two,
+// every merge split in parts of the same length along its merge path so all the threads merge until the last round
+// buff is a scratch buffer of at least length elements
+template<typename T>
+void parallel_sort(T* data, size_t length, T* buff, ThreadPool& pool = ThreadPool::shared()) {
+    const size_t nb_threads = pool.get_nb_threads();
+    if (nb_threads < 2 || length < SORT_PARALLEL_MIN_LENGTH) {
+        sort<T>(data, length, buff);
+        return;
+    }
+
+    // A power of 2 of segments, the boundaries of the runs of a round are boundaries of the runs of the previous one
+    size_t nb_runs = 1;
+    while (nb_runs < nb_threads) nb_runs *= 2;
+    pool.parallel_for(nb_runs, [&](int64_t r) {
+        const size_t start = length * r / nb_runs;
+        const size_t end = length * (r + 1) / nb_runs;
+        sort<T>(&data[start], end - start, &buff[start]);
+    });
+
+    // Runs merged from src to dst
+    T* src = data;
+    T* dst = buff;
+    for (; nb_runs > 1; nb_runs /= 2) {
+        const size_t nb_merges = nb_runs / 2;
+        const size_t nb_parts = nb_threads * SORT_PARALLEL_PARTS_PER_THREAD > nb_merges ? nb_threads * SORT_PARALLEL_PARTS_PER_THREAD / nb_merges : 1;
+
+        pool.parallel_for(nb_merges * nb_parts, [&](int64_t k) {
+            const size_t m = k / nb_parts;
+            const size_t p = k % nb_parts;
+            const size_t start = length * (2 * m) / nb_runs;
+            const size_t mid = length * (2 * m + 1) / nb_runs;
+            const size_t end = length * (2 * m + 2) / nb_runs;
+            const size_t out_start = (end - start) * p / nb_parts;
+            const size_t out_end = (end - start) * (p + 1) / nb_parts;
+
+            // Return directly if no merge is needed, the part is copied
+            if (!(src[mid - 1] > src[mid])) {
+                for (size_t i = start + out_start; i < start + out_end; i++) dst[i] = src[i];
+                return;
+            }
+
+            const size_t i0 = _merge_path(&src[start], mid - start, &src[mid], end - mid, out_start);
+            const size_t i1 = _merge_path(&src[start], mid - start, &src[mid], end - mid, out_end);
+            const size_t j0 = out_start - i0;
+            const size_t j1 = out_end - i1;
+            _merge_into(&src[start + i0], i1 - i0, &src[mid + j0], j1 - j0, &dst[start + out_start]);
+        });
+
+        T* x = src;
+        src = dst;
+        dst = x;
+    }
+
+    if (src != data) {
+        const size_t nb_parts = nb_threads * SORT_PARALLEL_PARTS_PER_THREAD;
+        pool.parallel_for(nb_parts, [&](int64_t p) {
+            for (size_t i = length * p / nb_parts, m = length * (p + 1) / nb_parts; i < m; i++) data[i] = src[i];
+        });
+    }
+}
+
+
+// Same with a scratch buffer on the heap
+template<typename T>
+void parallel_sort(T* data, size_t length, ThreadPool& pool = ThreadPool::shared()) {
+    T* buff = new T[length];
+    parallel_sort<T>(data, length, buff, pool);
+    delete[] buff;
+}
+
+
+// Insert value in the top of at most k greatest values (sorted from the greatest), count is its number of values
+// Equal values are kept from the last inserted, like when reading the result of sort() from its end
+// Inserting n values costs O(n) when few of them enter the top and O(n k) at worst
+template<typename T>
+inline void top_insert(T* top, size_t* count, size_t k, const T& value) {
+    size_t i = *count;
+    if (i == k) {
+        if (k == 0 || top[k - 1] > value) return;
+        i--;
+    } else {
+        (*count)++;
+    }
+    for (; i > 0 && !(top[i - 1] > value); i--) {
+        top[i] = top[i - 1];
+    }
+    top[i] = value;
 }
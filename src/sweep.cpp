@@ -0,0 +1,215 @@
+#include "sweep.h"
+
+#include "audio.h"
+#include "extractor.h"
+#include "note_tracker.h"
+#include "thread_pool.h"
+#include "sort.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <inttypes.h>
+#include <fstream>
+#include <sstream>
+
+
+static const int32_t SWEEP_NB_NOTES[] = {2, 4, 6};
+static const double SWEEP_THRESHOLD_WINDOWS[] = {0., 2., 5.};
+static const InterpretorSmoothing SWEEP_SMOOTHINGS[] = {SMOOTHING_NONE, SMOOTHING_MEDIAN, SMOOTHING_EXPONENTIAL};
+static const int32_t SWEEP_PEEK_NEIGHBOURHOODS[] = {0, 1, 3};
+
+#define SWEEP_SMOOTHING_DURATION (.25) // In seconds
+
+
+static const char* SMOOTHING_NAMES[] = {"none", "median", "exp"};
+
+
+// Operator override needed to rank the results
+struct SweepRank {
+    float score;
+    uint32_t index;
+
+    inline bool operator>(const SweepRank& other) const {
+        return score > other.score;
+    }
+};
+
+
+std::vector<sweep_config_t> sweep_default_configs() {
+    std::vector<sweep_config_t> configs;
+    for (const int32_t nb_notes : SWEEP_NB_NOTES) {
+        for (const double threshold_window : SWEEP_THRESHOLD_WINDOWS) {
+            for (const InterpretorSmoothing smoothing : SWEEP_SMOOTHINGS) {
+                for (const bool harmony : {false, true}) {
+                    for (const int32_t neighbourhood : SWEEP_PEEK_NEIGHBOURHOODS) {
+                        configs.push_back({nb_notes, threshold_window, smoothing, SWEEP_SMOOTHING_DURATION, harmony, neighbourhood, 0.f});
+                    }
+                }
+            }
+        }
+    }
+    return configs;
+}
+
+
+int sweep_read_notes(const std::string& path, std::vector<std::vector<Note>>* frames) {
+    std::ifstream file(path);
+    if (!file) return 1;
+
+    frames->clear();
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream words(line);
+        std::string word;
+        if (!(words >> word)) continue; // Time of the frame
+
+        std::vector<Note> notes;
+        while (words >> word) {
+            Note note;
+            if (sscanf(word.c_str(), "%f:%f", &note.freq, &note.strength) != 2) return 1;
+            notes.push_back(note);
+        }
+        frames->push_back(std::move(notes));
+    }
+
+    return 0;
+}
+
+
+// Notes of a frame matching a reference note (within half a semitone), each note matches once
+static int32_t count_matches(const Note* notes, size_t nb_notes, const std::vector<Note>& reference) {
+    int32_t nb_matches = 0;
+    uint64_t matched = 0; // Bit of each note of the frame already matched
+    for (const Note& ref : reference) {
+        for (size_t i = 0; i < nb_notes && i < 64; i++) {
+            const float ratio = notes[i].freq > ref.freq ? notes[i].freq / ref.freq : ref.freq / notes[i].freq;
+            if (!(matched >> i & 1) && ratio <= NOTE_TRACKER_MATCH_RATIO) {
+                matched |= (uint64_t) 1 << i;
+                nb_matches++;
+                break;
+            }
+        }
+    }
+    return nb_matches;
+}
+
+
+// Interpret all the frames with a configuration, then track and score its notes
+static void evaluate(Extractor* extractor, const float* strengths, size_t nb_frames, int32_t nps, int32_t fps,
+                     const std::vector<std::vector<Note>>& reference, const sweep_config_t* config, sweep_result_t* result) {
+    const size_t nb_entries = extractor->histogram.nb_entries;
+    const size_t nb_notes = config->nb_notes;
+
+    Interpretor interpretor;
+    interpretor.set_extractor(extractor);
+    interpretor.set_threshold_window(config->threshold_window, fps);
+    interpretor.set_smoothing(config->smoothing, config->smoothing_duration, fps);
+    uint32_t stages = STAGE_HUMAN_HEAR;
+    if (config->smoothing != SMOOTHING_NONE) stages |= STAGE_SMOOTH;
+    if (config->harmony) stages |= STAGE_HARMONY;
+    if (config->peek_neighbourhood > 0) {
+        interpretor.set_peeks(config->peek_neighbourhood, config->peek_prominence);
+        stages |= STAGE_PEEKS;
+    }
+
+    // The stages change the strengths : each configuration works on its own copy of the shared ones
+    std::vector<float> frame_strengths(strengths, strengths + nb_frames * nb_entries);
+    std::vector<Note> notes(nb_frames * nb_notes);
+    std::vector<size_t> frame_nb_notes(nb_frames);
+
+    const uint64_t start = micros();
+    result->nb_notes = interpretor.extract_notes_batch(frame_strengths.data(), nb_frames, stages, notes.data(), frame_nb_notes.data(), nb_notes);
+    result->time = micros() - start;
+    result->config = *config;
+
+    // Notes started like in the main loop (flickering notes start many times)
+    NoteTracker tracker(nb_notes);
+    tracker.set_min_duration(.5 / nps);
+    tracker.set_min_cut(.5 / nps);
+    std::vector<NoteEvent> events(tracker.get_max_events());
+    result->nb_starts = 0;
+    for (size_t f = 0; f < nb_frames; f++) {
+        const size_t nb_events = tracker.update(&notes[f * nb_notes], frame_nb_notes[f], (double) f / fps, events.data());
+        for (size_t e = 0; e < nb_events; e++) result->nb_starts += events[e].type == NOTE_START;
+    }
+
+    // Frames after the end of the reference aren't scored
+    int64_t nb_matches = 0, nb_found = 0, nb_expected = 0;
+    for (size_t f = 0; f < nb_frames && f < reference.size(); f++) {
+        nb_matches += count_matches(&notes[f * nb_notes], frame_nb_notes[f], reference[f]);
+        nb_found += frame_nb_notes[f];
+        nb_expected += reference[f].size();
+    }
+    result->precision = nb_found > 0 ? (float) nb_matches / nb_found : 0.f;
+    result->recall = nb_expected > 0 ? (float) nb_matches / nb_expected : 0.f;
+    const float sum = result->precision + result->recall;
+    result->score = sum > 0.f ? 2.f * result->precision * result->recall / sum : 0.f;
+}
+
+
+int sweep_run(const std::string& filename, const std::string& reference, int32_t nps, int32_t fps, int32_t analysis_rate,
+              const std::vector<sweep_config_t>& configs, std::vector<sweep_result_t>* results) {
+    ThreadPool& pool = ThreadPool::shared();
+
+    std::vector<std::vector<Note>> reference_notes;
+    if (!reference.empty() && sweep_read_notes(reference, &reference_notes)) return 1;
+
+    Audio audio;
+    Audio analysis_audio;
+    int r = audio.open_file(filename);
+    if (r) return r;
+    audio.convert_to_monochannel();
+    r = analysis_audio.resample(&audio, analysis_rate);
+    if (r) return r;
+
+    // Histograms of all the frames, computed once for all the configurations
+    const uint64_t analysis_start = micros();
+    Extractor extractor;
+    extractor.set_audio(&analysis_audio);
+    extractor.set_window_width(1.f / (float) nps);
+    extractor.set_freq_domain(20, 5000);
+
+    const size_t nb_frames = (size_t) ceil((double) analysis_audio.length / analysis_audio.rate * fps);
+    const size_t nb_entries = extractor.histogram.nb_entries;
+    std::vector<float> strengths(nb_frames * nb_entries);
+    for (size_t f = 0; f < nb_frames; f++) {
+        for (size_t i = 0; i < nb_entries; i++) strengths[f * nb_entries + i] = extractor.histogram.entries[i].value;
+        extractor.forward(1. / fps);
+    }
+    const double analysis_time = (micros() - analysis_start) / 1e6;
+
+    printf("%s : %zu frames of %zu entries analyzed in %.2fs, %zu configurations on %i threads\n", filename.c_str(), nb_frames,
+        nb_entries, analysis_time, configs.size(), pool.get_nb_threads());
+
+    // Configurations in parallel, the matrix is only read
+    std::vector<sweep_result_t> all_results(configs.size());
+    const uint64_t start = micros();
+    pool.parallel_for((int64_t) configs.size(), [&](int64_t c) {
+        evaluate(&extractor, strengths.data(), nb_frames, nps, fps, reference_notes, &configs[c], &all_results[c]);
+    });
+    const double elapsed = (micros() - start) / 1e6;
+
+    // From the best score
+    std::vector<SweepRank> ranks(all_results.size());
+    for (size_t c = 0; c < ranks.size(); c++) ranks[c] = SweepRank {all_results[c].score, (uint32_t) c};
+    sort(ranks.data(), ranks.size());
+
+    printf("\n%-6s %-8s %-8s %-8s %-8s %-10s %-8s %-8s %-10s %-8s %s\n", "max", "window", "smooth", "harmony", "peeks",
+        "frames/s", "notes", "starts", "precision", "recall", "score");
+    for (size_t k = ranks.size(); k-- > 0;) {
+        const sweep_result_t& result = all_results[ranks[k].index];
+        const sweep_config_t& config = result.config;
+        printf("%-6i %-8.1f %-8s %-8s %-8i %-10.0f %-8" PRId64 " %-8" PRId64 " %-10.3f %-8.3f %.3f\n", config.nb_notes,
+            config.threshold_window, SMOOTHING_NAMES[config.smoothing], config.harmony ? "yes" : "no", config.peek_neighbourhood,
+            nb_frames / max(result.time / 1e6, 1e-9), result.nb_notes, result.nb_starts, result.precision, result.recall, result.score);
+    }
+
+    printf("\n%zu configurations in %.2fs : %.1f configurations/s, %.0f frames/s (analysis of the frames once : %.2fs)\n",
+        configs.size(), elapsed, configs.size() / max(elapsed, 1e-9), configs.size() * nb_frames / max(elapsed, 1e-9), analysis_time);
+
+    if (results) *results = std::move(all_results);
+
+    return 0;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+// Tune the interpretor : the histograms of a file are analyzed once, then many configurations of the interpretor are
+// evaluated in parallel over them and scored against reference notes
+
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "interpretor.h"
+
+
+typedef struct {
+    int32_t nb_notes; // Maximum number of simultaneous notes
+    double threshold_window; // In seconds, 0 for the threshold of the current frame only
+    InterpretorSmoothing smoothing;
+    double smoothing_duration; // In seconds
+    bool harmony; // keep_harmony stage
+    int32_t peek_neighbourhood; // 0 without the keep_peeks stage
+    float peek_prominence;
+} sweep_config_t;
+
+
+typedef struct {
+    sweep_config_t config;
+    uint64_t time; // Of the interpretation of all the frames in microseconds
+    int64_t nb_notes; // Notes of all the frames
+    int64_t nb_starts; // Notes started once tracked (minimum duration and cut of half a note)
+    float precision; // Notes of the frames found in the reference (0 without reference)
+    float recall; // Notes of the reference found in the frames
+    float score; // F1 score : harmonic mean of the precision and the recall
+} sweep_result_t;
+
+
+// Configurations crossing the usual values of each parameter
+std::vector<sweep_config_t> sweep_default_configs();
+
+// Read notes written by the batch mode (one line per frame : time then frequency:strength of each note)
+// Return 0 on success or an error code
+int sweep_read_notes(const std::string& path, std::vector<std::vector<Note>>* frames);
+
+// Analyze the file then evaluate the configurations on the shared thread pool, print the results from the best score
+// reference is a file of notes read by sweep_read_notes (no score if empty), results receives the results in the order
+// of the configurations (ignored if nullptr)
+// Return 0 on success or an error code
+int sweep_run(const std::string& filename, const std::string& reference, int32_t nps, int32_t fps, int32_t analysis_rate,
+              const std::vector<sweep_config_t>& configs, std::vector<sweep_result_t>* results);
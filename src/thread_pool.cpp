@@ -0,0 +1,96 @@
+#include "thread_pool.h"
+
+#include <atomic>
+#include <algorithm>
+
+
+struct ThreadPoolJob {
+    const std::function<void(int64_t)>* fn;
+    int64_t n;
+    std::atomic<int64_t> next; // Next iteration to start
+    int32_t nb_workers; // Workers running iterations of the job (guarded by the pool mutex)
+};
+
+
+ThreadPool::ThreadPool(int32_t nb_threads) {
+    if (nb_threads <= 0) nb_threads = std::max<int32_t>(std::thread::hardware_concurrency(), 1);
+    stop = false;
+    for (int32_t i = 1; i < nb_threads; i++) {
+        threads.emplace_back(&ThreadPool::run, this);
+    }
+}
+
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    jobs_cond.notify_all();
+    for (std::thread& thread : threads) thread.join();
+}
+
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
+
+
+// Run iterations of a job until they are all started
+void ThreadPool::run_job(ThreadPoolJob* job) {
+    int64_t i;
+    while ((i = job->next.fetch_add(1)) < job->n) {
+        (*job->fn)(i);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = std::find(jobs.begin(), jobs.end(), job);
+    if (it != jobs.end()) jobs.erase(it);
+}
+
+
+void ThreadPool::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        jobs_cond.wait(lock, [&]{ return stop || !jobs.empty(); });
+        if (stop) return;
+
+        ThreadPoolJob* job = jobs.front();
+        job->nb_workers++;
+        lock.unlock();
+
+        run_job(job);
+
+        lock.lock();
+        job->nb_workers--;
+        done_cond.notify_all();
+    }
+}
+
+
+void ThreadPool::parallel_for(int64_t n, const std::function<void(int64_t)>& fn) {
+    if (n <= 0) return;
+    if (n == 1 || threads.empty()) {
+        for (int64_t i = 0; i < n; i++) fn(i);
+        return;
+    }
+
+    ThreadPoolJob job;
+    job.fn = &fn;
+    job.n = n;
+    job.next = 0;
+    job.nb_workers = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(&job);
+    }
+    jobs_cond.notify_all();
+
+    run_job(&job);
+
+    // All iterations are started, wait for the workers still running some
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cond.wait(lock, [&]{ return job.nb_workers == 0; });
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+// Pool of worker threads for the parallel parts of the program
+
+
+#include <stdint.h>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+
+
+struct ThreadPoolJob;
+
+
+class ThreadPool {
+private:
+    std::vector<std::thread> threads;
+    std::deque<ThreadPoolJob*> jobs; // Jobs with iterations not started yet
+    std::mutex mutex;
+    std::condition_variable jobs_cond;
+    std::condition_variable done_cond;
+    bool stop;
+
+    void run();
+    void run_job(ThreadPoolJob* job);
+
+public:
+    // nb_threads is the number of threads running a job including the calling one, 0 for the number of cores
+    ThreadPool(int32_t nb_threads = 0);
+    ~ThreadPool();
+
+    inline int32_t get_nb_threads() const { return (int32_t) threads.size() + 1; }
+
+    // Call fn(i) for i from 0 to n (excluded) on the workers and the calling thread, return once all calls are done
+    // Jobs can be nested : a call waiting for its iterations runs them instead of blocking a worker
+    void parallel_for(int64_t n, const std::function<void(int64_t)>& fn);
+
+    // Pool shared by the whole program
+    static ThreadPool& shared();
+};
@@ -4,6 +4,8 @@
 
 #include <concepts>
 #include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
 #include <math.h>
 
 
@@ -20,11 +22,23 @@ inline uint32_t ltohi(const uint32_t v) {
     return  (x[3] << 24) | (x[2] << 16) | (x[1] << 8) | x[0];
 }
 
+inline uint64_t ltohl(const uint64_t v) {
+    const uint8_t* x = (uint8_t*) &v;
+    uint64_t r = 0;
+    for (int i = 8; i--;) r = (r << 8) | x[i];
+    return r;
+}
+
 inline int16_t utoss(const uint16_t v) {
     return *((int16_t*)&v);
 }
 
 
+inline size_t align_up(const size_t v, const size_t alignment) {
+    return (v + alignment - 1) / alignment * alignment;
+}
+
+
 template<typename T>
 inline T min(const T a, const T b) {
     return a > b ? b : a;
@@ -78,15 +92,36 @@ static inline uint64_t millis() {
     return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
+static inline uint64_t micros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 
 #ifdef _WIN32
 
 #define WIN32_LEAN_AND_MEAN
 #include "windows.h"
+#include <malloc.h>
 static inline void sleep(uint32_t duration) {
     Sleep(duration);
 }
 
+static inline void* aligned_malloc(size_t size, size_t alignment) {
+    return _aligned_malloc(size, alignment);
+}
+
+static inline void aligned_free(void* ptr) {
+    _aligned_free(ptr);
+}
+
+static inline int file_seek(FILE* file, int64_t offset, int origin) {
+    return _fseeki64(file, offset, origin);
+}
+
+static inline int64_t file_tell(FILE* file) {
+    return _ftelli64(file);
+}
+
 #else
 
 #include <unistd.h>
@@ -94,4 +129,21 @@ static inline void sleep(uint32_t duration) {
     usleep(duration * 1000);
 }
 
+// Size is rounded up to the alignment (required by aligned_alloc)
+static inline void* aligned_malloc(size_t size, size_t alignment) {
+    return aligned_alloc(alignment, align_up(size, alignment));
+}
+
+static inline void aligned_free(void* ptr) {
+    free(ptr);
+}
+
+static inline int file_seek(FILE* file, int64_t offset, int origin) {
+    return fseeko(file, offset, origin);
+}
+
+static inline int64_t file_tell(FILE* file) {
+    return ftello(file);
+}
+
 #endif
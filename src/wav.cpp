@@ -0,0 +1,229 @@
+#include "wav.h"
+
+#include "utils.h"
+
+#include <string.h>
+#include <inttypes.h>
+
+
+#pragma pack(push,1)
+
+typedef struct {
+    uint16_t audio_format;
+    uint16_t nb_channels;
+    uint32_t frequency;
+    uint32_t bytes_per_sec;
+    uint16_t bytes_per_block;
+    uint16_t bits_per_sample;
+} wav_fmt_t;
+
+#pragma pack(pop)
+
+
+// GUIDs of the Sony Wave64 chunks (the four first bytes are the name of the RIFF chunk)
+static const uint8_t W64_GUID_RIFF[16] = {'r','i','f','f', 0x2E,0x91,0xCF,0x11, 0xA5,0xD6, 0x28,0xDB,0x04,0xC1,0x00,0x00};
+static const uint8_t W64_GUID_WAVE[16] = {'w','a','v','e', 0xF3,0xAC,0xD3,0x11, 0x8C,0xD1, 0x00,0xC0,0x4F,0x8E,0xDB,0x8A};
+static const uint8_t W64_GUID_FMT[16]  = {'f','m','t',' ', 0xF3,0xAC,0xD3,0x11, 0x8C,0xD1, 0x00,0xC0,0x4F,0x8E,0xDB,0x8A};
+static const uint8_t W64_GUID_DATA[16] = {'d','a','t','a', 0xF3,0xAC,0xD3,0x11, 0x8C,0xD1, 0x00,0xC0,0x4F,0x8E,0xDB,0x8A};
+
+
+static inline bool is_id(const char* id, const char* expected) {
+    return id[0] == expected[0] && id[1] == expected[1] && id[2] == expected[2] && id[3] == expected[3];
+}
+
+
+// Read the format chunk (the format of extensible files is replaced by their sub format)
+static int read_fmt_chunk(FILE* file, int64_t chunk_size, wav_fmt_t* fmt) {
+    if (chunk_size < (int64_t) sizeof(wav_fmt_t) || fread(fmt, 1, sizeof(wav_fmt_t), file) != sizeof(wav_fmt_t)) {
+        return 8;
+    }
+    chunk_size -= sizeof(wav_fmt_t);
+
+    if (ltohs(fmt->audio_format) == WAV_FMT_EXTENSIBLE) {
+        #pragma pack(push,1)
+        struct {
+            uint16_t extension_size;
+            uint16_t valid_bits_per_sample;
+            uint32_t channel_mask;
+            uint8_t sub_format[16]; // The two first bytes are the format code
+        } ext;
+        #pragma pack(pop)
+
+        if (chunk_size < (int64_t) sizeof(ext) || fread(&ext, 1, sizeof(ext), file) != sizeof(ext)) {
+            return 8;
+        }
+        chunk_size -= sizeof(ext);
+        memcpy(&fmt->audio_format, ext.sub_format, sizeof(uint16_t));
+    }
+
+    if (file_seek(file, chunk_size, SEEK_CUR)) {
+        return 7;
+    }
+    return 0;
+}
+
+
+// Chunks of RIFF, RF64 and BW64 files (sizes of RF64 and BW64 files bigger than 4 GB are in the ds64 chunk)
+static int parse_riff_chunks(FILE* file, wav_fmt_t* fmt, int64_t* data_size, bool rf64) {
+    bool fmt_found = false;
+    int64_t ds64_data_size = -1;
+
+    struct {
+        char id[4];
+        uint32_t size;
+    } chunk;
+
+    while(1) {
+        if (fread(&chunk, 1, sizeof(chunk), file) != sizeof(chunk)) {
+            return 5;
+        }
+
+        //printf("Chunk ID : %c%c%c%c\n", chunk.id[0], chunk.id[1], chunk.id[2], chunk.id[3]);
+
+        int64_t chunk_size = ltohi(chunk.size);
+        const int64_t padding = chunk_size & 1; // Chunks are padded to an even size
+
+        if (is_id(chunk.id, "fmt ")) {
+            int r = read_fmt_chunk(file, chunk_size, fmt);
+            if (r) return r;
+            fmt_found = true;
+            chunk_size = 0;
+        }
+
+        else if (is_id(chunk.id, "ds64") && rf64) {
+            uint64_t sizes[3]; // RIFF size, data size and number of samples
+            if (chunk_size < (int64_t) sizeof(sizes) || fread(sizes, 1, sizeof(sizes), file) != sizeof(sizes)) {
+                return 15;
+            }
+            ds64_data_size = ltohl(sizes[1]);
+            chunk_size -= sizeof(sizes);
+        }
+
+        else if (is_id(chunk.id, "data")) {
+            if (!fmt_found) {
+                return 9;
+            }
+            *data_size = (chunk.size == 0xFFFFFFFF && ds64_data_size >= 0) ? ds64_data_size : chunk_size;
+            return 0;
+        }
+
+        // Other chunks (JUNK, LIST, ...) are skipped
+        if (file_seek(file, chunk_size + padding, SEEK_CUR)) {
+            return 7;
+        }
+    }
+}
+
+
+// Chunks of Sony Wave64 files (GUID identifiers and 64 bits sizes including the chunk header)
+static int parse_w64_chunks(FILE* file, wav_fmt_t* fmt, int64_t* data_size) {
+    bool fmt_found = false;
+
+    struct {
+        uint8_t guid[16];
+        uint64_t size;
+    } chunk;
+
+    while(1) {
+        if (fread(&chunk, 1, sizeof(chunk), file) != sizeof(chunk)) {
+            return 5;
+        }
+
+        int64_t chunk_size = (int64_t) ltohl(chunk.size) - (int64_t) sizeof(chunk);
+        if (chunk_size < 0) {
+            return 16;
+        }
+        const int64_t padding = (8 - ltohl(chunk.size) % 8) % 8; // Chunks are aligned on 8 bytes
+
+        if (memcmp(chunk.guid, W64_GUID_FMT, 16) == 0) {
+            int r = read_fmt_chunk(file, chunk_size, fmt);
+            if (r) return r;
+            fmt_found = true;
+            chunk_size = 0;
+        }
+
+        else if (memcmp(chunk.guid, W64_GUID_DATA, 16) == 0) {
+            if (!fmt_found) {
+                return 9;
+            }
+            *data_size = chunk_size;
+            return 0;
+        }
+
+        // Other chunks are skipped
+        if (file_seek(file, chunk_size + padding, SEEK_CUR)) {
+            return 7;
+        }
+    }
+}
+
+
+int wav_parse_header(FILE* file, wav_info_t* info) {
+    struct {
+        char fingerprint[4];
+        uint32_t file_size;
+        char file_format_id[4];
+    } hdr_file;
+
+    wav_fmt_t hdr_fmt;
+    int64_t data_size;
+    int r;
+
+    if (fread(&hdr_file, 1, sizeof(hdr_file), file) != sizeof(hdr_file)) {
+        return 2;
+    }
+
+    const char* fgp = hdr_file.fingerprint;
+
+    if (is_id(fgp, "riff")) {
+        // Rest of the Wave64 header : end of the RIFF GUID, 64 bits size and WAVE GUID
+        uint8_t hdr_w64[40];
+        memcpy(hdr_w64, &hdr_file, sizeof(hdr_file));
+        if (fread(&hdr_w64[sizeof(hdr_file)], 1, sizeof(hdr_w64) - sizeof(hdr_file), file) != sizeof(hdr_w64) - sizeof(hdr_file)) {
+            return 2;
+        }
+        if (memcmp(hdr_w64, W64_GUID_RIFF, 16) != 0) {
+            return 3;
+        }
+        if (memcmp(&hdr_w64[24], W64_GUID_WAVE, 16) != 0) {
+            return 4;
+        }
+        r = parse_w64_chunks(file, &hdr_fmt, &data_size);
+    }
+
+    else {
+        const bool rf64 = is_id(fgp, "RF64") || is_id(fgp, "BW64");
+        if (!rf64 && !is_id(fgp, "RIFF")) {
+            return 3;
+        }
+        if (!is_id(hdr_file.file_format_id, "WAVE")) {
+            return 4;
+        }
+        r = parse_riff_chunks(file, &hdr_fmt, &data_size, rf64);
+    }
+
+    if (r) {
+        return r;
+    }
+
+    info->format = ltohs(hdr_fmt.audio_format);
+    info->nb_channels = ltohs(hdr_fmt.nb_channels);
+    info->frequency = ltohi(hdr_fmt.frequency);
+    info->sample_width = ltohs(hdr_fmt.bits_per_sample);
+    info->block_align = ltohs(hdr_fmt.bytes_per_block);
+    info->data_offset = file_tell(file);
+    info->data_size = data_size;
+
+    return 0;
+}
+
+
+void wav_print_info(const wav_info_t* info) {
+    printf("Data size : %" PRId64 "\n", info->data_size);
+    printf("Nb channels : %i\n", info->nb_channels);
+    printf("Sample width : %i\n", info->sample_width);
+    printf("Nb samples : %" PRId64 "\n", info->data_size * 8 / info->sample_width);
+    printf("Frequency : %i\n", info->frequency);
+
+    fflush(stdout);
+}
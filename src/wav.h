@@ -0,0 +1,31 @@
+#pragma once
+
+// Parse WAV files headers
+
+
+#include <stdio.h>
+#include <stdint.h>
+
+
+#define WAV_FMT_PCM_INT 1
+#define WAV_FMT_PCM_FLOAT 3
+#define WAV_FMT_EXTENSIBLE 0xFFFE
+
+
+typedef struct {
+    uint16_t format; // Sub format for WAV_FMT_EXTENSIBLE
+    uint16_t nb_channels;
+    uint32_t frequency;
+    uint16_t sample_width; // In bits
+    uint16_t block_align; // Size of one frame (one sample of each channel) in bytes
+    int64_t data_offset; // Offset of the samples from the begining of the file
+    int64_t data_size;
+} wav_info_t;
+
+
+// Parse chunks until the data chunk, the file is left at the begining of the samples
+// Return 0 on success or an error code
+int wav_parse_header(FILE* file, wav_info_t* info);
+
+// Print informations of a WAV file
+void wav_print_info(const wav_info_t* info);